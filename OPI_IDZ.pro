@@ -1,3 +1,19 @@
-QT += widgets
+QT += widgets network
 CONFIG += c++17
 SOURCES += main.cpp
+HEADERS += formats.h textwriter.h textcodec.h cpu.h cancel.h parsecache.h docstats.h reload.h diff.h diffview.h scheduler.h durable.h observer.h editor.h edittrace.h replay.h tracing.h watchdog.h profiler.h metrics.h autosave.h
+
+# qmake CONFIG+=notrace compiles the tracing spans out entirely.
+notrace: DEFINES += OPI_NO_TRACING
+
+# Exported symbols let the stall watchdog and the profiler name frames in stack samples.
+linux: QMAKE_LFLAGS += -rdynamic
+# Working-set size for the metrics panel.
+win32: LIBS += -lpsapi
+
+# io_uring autosave backend when liburing is installed; otherwise autosave uses a thread pool.
+linux:packagesExist(liburing) {
+    CONFIG += link_pkgconfig
+    PKGCONFIG += liburing
+    DEFINES += OPI_HAVE_IO_URING
+}
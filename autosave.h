@@ -0,0 +1,611 @@
+#pragma once
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QString>
+#include <QtGlobal>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+#include "durable.h"
+#include "formats.h"
+#include "scheduler.h"
+#include "tracing.h"
+
+#ifdef OPI_HAVE_IO_URING
+#include <liburing.h>
+#include <sys/uio.h>
+#include <cstdlib>
+#endif
+
+// ---------------- Autosave backends ----------------
+// Autosave hands the document snapshot to a backend and returns at once; the
+// backend encodes and writes it and reports back through a callback on its own
+// thread. Only the newest pending snapshot of a path is written: older ones
+// complete as `superseded`, and a write in progress whose saver token is
+// cancelled stops at its next chunk, leaving the old file (see Bounded).
+//
+//   sync     saver->save() on the calling thread (the old behaviour)
+//   threads  saver->save() as background tasks on the shared scheduler
+//   uring    one thread encodes into registered buffers while earlier chunks
+//            are in flight as io_uring writes (Linux, built with liburing)
+//   auto     uring if the kernel allows it, otherwise threads
+//
+// create() wraps the chosen backend in Bounded, which limits how many
+// snapshots wait for the disk (see Backpressure below).
+namespace autosave {
+
+struct Job {
+    QString path;
+    std::shared_ptr<IFileSaver> saver;
+    QString text; // implicitly shared snapshot
+};
+
+struct Outcome {
+    QString path;
+    bool ok = false;
+    bool superseded = false;
+    bool dropped = false; // not queued: over the byte budget; submit again later
+    qint64 bytes = 0;
+    qint64 ns = 0; // from submit() to completion
+};
+
+using Done = std::function<void(const Outcome &)>;
+
+class Backend {
+public:
+    virtual ~Backend() = default;
+    virtual const char *name() const = 0;
+    // done runs on a backend thread (or inline for sync).
+    virtual void submit(Job job, Done done) = 0;
+    // Blocks until every submitted job has completed.
+    virtual void waitForIdle() = 0;
+    // How long the caller should hold back its next snapshot; grows while
+    // writes fall behind.
+    virtual int suggestedDelayMs() const { return 0; }
+};
+
+class SyncBackend : public Backend {
+public:
+    const char *name() const override { return "sync"; }
+    void submit(Job job, Done done) override {
+        QElapsedTimer t;
+        t.start();
+        Outcome o;
+        o.path = job.path;
+        job.saver->setKind(durable::Kind::Autosave);
+        o.ok = job.saver->save(job.path, job.text);
+        o.bytes = QFileInfo(job.path).size();
+        o.ns = t.nsecsElapsed();
+        done(o);
+    }
+    void waitForIdle() override {}
+};
+
+// Numbers submissions per path so a job can tell it was overtaken before it
+// started.
+class Generations {
+public:
+    quint64 next(const QString &path) {
+        std::lock_guard<std::mutex> lock(mu);
+        return ++newest[path];
+    }
+    bool isNewest(const QString &path, quint64 gen) const {
+        std::lock_guard<std::mutex> lock(mu);
+        return newest.value(path) == gen;
+    }
+
+private:
+    mutable std::mutex mu;
+    QHash<QString, quint64> newest;
+};
+
+class ThreadPoolBackend : public Backend {
+public:
+    ~ThreadPoolBackend() override { tasks.wait(); }
+
+    const char *name() const override { return "threads"; }
+
+    void submit(Job job, Done done) override {
+        const quint64 gen = gens.next(job.path);
+        job.saver->setKind(durable::Kind::Autosave);
+        QElapsedTimer t;
+        t.start();
+        sched::scheduler().submit(sched::Priority::Background, [this, job = std::move(job), done = std::move(done), gen, t]() {
+            OPI_TRACE_SCOPE("autosave::write");
+            Outcome o;
+            o.path = job.path;
+            {
+                // Writers of one path take turns; a stale snapshot is dropped.
+                std::shared_ptr<std::mutex> lock = pathLock(job.path);
+                std::lock_guard<std::mutex> guard(*lock);
+                if (!gens.isNewest(job.path, gen)) {
+                    o.superseded = o.ok = true;
+                } else {
+                    o.ok = job.saver->save(job.path, job.text);
+                    if (o.ok) o.bytes = QFileInfo(job.path).size();
+                    else if (job.saver->cancelled()) o.superseded = o.ok = true; // a newer snapshot is on its way
+                }
+            }
+            o.ns = t.nsecsElapsed();
+            done(o);
+        }, &tasks);
+    }
+
+    void waitForIdle() override { tasks.wait(); }
+
+private:
+    sched::TaskGroup tasks;
+    Generations gens;
+    std::mutex locksMu;
+    QHash<QString, std::shared_ptr<std::mutex>> locks;
+
+    std::shared_ptr<std::mutex> pathLock(const QString &path) {
+        std::lock_guard<std::mutex> guard(locksMu);
+        std::shared_ptr<std::mutex> &m = locks[path];
+        if (!m) m = std::make_shared<std::mutex>();
+        return m;
+    }
+};
+
+#ifdef OPI_HAVE_IO_URING
+class UringBackend : public Backend {
+public:
+    static constexpr int depth = 4;                          // chunks in flight
+    static constexpr qsizetype chunkSize = qsizetype(1) << 20;
+
+    // Null if the kernel (or a seccomp policy) refuses io_uring.
+    static std::unique_ptr<UringBackend> create() {
+        std::unique_ptr<UringBackend> b(new UringBackend);
+        if (!b->ready) return nullptr;
+        b->worker = std::thread([p = b.get()]() { p->run(); });
+        return b;
+    }
+
+    ~UringBackend() override {
+        if (worker.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(mu);
+                stopping = true;
+            }
+            wake.notify_all();
+            worker.join();
+        }
+        if (ready) io_uring_queue_exit(&ring);
+        std::free(buffers);
+    }
+
+    const char *name() const override { return "uring"; }
+
+    void submit(Job job, Done done) override {
+        const quint64 gen = gens.next(job.path);
+        QElapsedTimer t;
+        t.start();
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            queue.push_back({std::move(job), std::move(done), gen, t});
+            ++pending;
+        }
+        wake.notify_one();
+    }
+
+    void waitForIdle() override {
+        std::unique_lock<std::mutex> lock(mu);
+        idle.wait(lock, [this]() { return pending == 0; });
+    }
+
+private:
+    struct Queued {
+        Job job;
+        Done done;
+        quint64 gen;
+        QElapsedTimer submitted;
+    };
+
+    // Chunks go out round-robin through the registered buffers; acquire()
+    // only waits when the next buffer is still being written.
+    class Sink : public utf8::Sink {
+    public:
+        Sink(UringBackend &backend, int file) : b(backend), fd(file) {}
+
+        char *acquire(qsizetype &capacity) override {
+            while (slots[cur].inFlight && reapOne()) {}
+            capacity = chunkSize;
+            return b.buffers + cur * chunkSize;
+        }
+
+        bool commit(qsizetype len) override {
+            if (failed) return false;
+            Slot &s = slots[cur];
+            s.inFlight = true;
+            s.len = len;
+            s.done = 0;
+            s.offset = offset;
+            offset += len;
+            queueWrite(cur);
+            cur = (cur + 1) % depth;
+            return !failed;
+        }
+
+        // Waits for the remaining writes; false if any failed.
+        bool finish() {
+            for (int i = 0; i < depth; ++i)
+                while (slots[i].inFlight && reapOne()) {}
+            return !failed;
+        }
+
+        qint64 written() const { return offset; }
+
+    private:
+        struct Slot {
+            bool inFlight = false;
+            qsizetype len = 0;
+            qsizetype done = 0;
+            qint64 offset = 0;
+        };
+        UringBackend &b;
+        int fd;
+        Slot slots[depth];
+        int cur = 0;
+        qint64 offset = 0;
+        bool failed = false;
+
+        void queueWrite(int i) {
+            Slot &s = slots[i];
+            io_uring_sqe *sqe = io_uring_get_sqe(&b.ring); // never full: at most `depth` in flight
+            io_uring_prep_write_fixed(sqe, fd, b.buffers + i * chunkSize + s.done, unsigned(s.len - s.done),
+                                      quint64(s.offset + s.done), i);
+            io_uring_sqe_set_data(sqe, reinterpret_cast<void *>(quintptr(i)));
+            if (io_uring_submit(&b.ring) < 0) {
+                failed = true;
+                s.inFlight = false;
+            }
+        }
+
+        // Handles one completion; false if waiting failed.
+        bool reapOne() {
+            io_uring_cqe *cqe = nullptr;
+            if (io_uring_wait_cqe(&b.ring, &cqe) < 0) {
+                failed = true;
+                for (Slot &s : slots) s.inFlight = false;
+                return false;
+            }
+            const int i = int(reinterpret_cast<quintptr>(io_uring_cqe_get_data(cqe)));
+            const int res = cqe->res;
+            io_uring_cqe_seen(&b.ring, cqe);
+            Slot &s = slots[i];
+            if (res <= 0) {
+                failed = true;
+                s.inFlight = false;
+            } else if ((s.done += res) < s.len) {
+                queueWrite(i); // short write: send the rest
+            } else {
+                s.inFlight = false;
+            }
+            return true;
+        }
+    };
+
+    io_uring ring;
+    bool ready = false;
+    char *buffers = nullptr;
+    Generations gens;
+    std::thread worker;
+    std::mutex mu;
+    std::condition_variable wake, idle;
+    std::deque<Queued> queue;
+    int pending = 0;
+    bool stopping = false;
+
+    UringBackend() {
+        if (io_uring_queue_init(depth * 2, &ring, 0) < 0) return;
+        if (posix_memalign(reinterpret_cast<void **>(&buffers), 4096, size_t(depth * chunkSize)) != 0) {
+            buffers = nullptr;
+            io_uring_queue_exit(&ring);
+            return;
+        }
+        iovec iov[depth];
+        for (int i = 0; i < depth; ++i) {
+            iov[i].iov_base = buffers + i * chunkSize;
+            iov[i].iov_len = size_t(chunkSize);
+        }
+        if (io_uring_register_buffers(&ring, iov, depth) < 0) {
+            io_uring_queue_exit(&ring);
+            return;
+        }
+        ready = true;
+    }
+
+    void run() {
+        while (true) {
+            Queued q;
+            {
+                std::unique_lock<std::mutex> lock(mu);
+                wake.wait(lock, [this]() { return stopping || !queue.empty(); });
+                if (queue.empty()) return; // stopping, and everything is written
+                q = std::move(queue.front());
+                queue.pop_front();
+            }
+            Outcome o;
+            o.path = q.job.path;
+            if (!gens.isNewest(q.job.path, q.gen)) {
+                o.superseded = o.ok = true;
+            } else {
+                OPI_TRACE_SCOPE("autosave::write");
+                write(q.job, o);
+                if (!o.ok && q.job.saver->cancelled()) o.superseded = o.ok = true;
+            }
+            o.ns = q.submitted.nsecsElapsed();
+            q.done(o);
+            {
+                std::lock_guard<std::mutex> lock(mu);
+                --pending;
+            }
+            idle.notify_all();
+        }
+    }
+
+    void write(const Job &job, Outcome &o) {
+        durable::AtomicFile file(job.path, durable::Kind::Autosave);
+        if (!file.open()) return;
+        Sink sink(*this, file.handle());
+        {
+            utf8::Writer out(&sink);
+            out.setCancelToken(job.saver->token());
+            job.saver->encode(out, job.text);
+            o.ok = out.flush();
+        }
+        o.ok = sink.finish() && o.ok && file.commit();
+        o.bytes = sink.written();
+    }
+};
+#endif
+
+// ---------------- Backpressure ----------------
+// When the disk is slower than the edits, snapshots must not pile up in
+// memory. Bounded sits in front of a backend:
+//   - per path, one write is in flight and at most one snapshot waits behind
+//     it; a newer snapshot replaces the waiting one (which completes as
+//     superseded), so the latest text always wins
+//   - all snapshots in flight or waiting, across every document, share one
+//     byte budget; a snapshot that does not fit completes as `dropped`
+//   - suggestedDelayMs() stretches with the measured write latency while a
+//     write is in flight, so the editor autosaves less often
+//   - a newer snapshot also cancels the write in flight, which stops at its
+//     next chunk, unless that write itself replaced a cancelled one: with a
+//     steady stream of edits on a slow disk at least every other snapshot
+//     still lands
+
+// Upper bounds of the write latency histogram buckets, in ms; one more
+// bucket counts everything slower.
+constexpr qint64 latencyBoundsMs[] = {1, 5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000};
+constexpr int latencyBuckets = int(sizeof(latencyBoundsMs) / sizeof(latencyBoundsMs[0])) + 1;
+
+struct QueueStats {
+    qint64 budget = 0;  // bytes
+    qint64 depth = 0;   // snapshots in flight or waiting
+    qint64 bytes = 0;   // held by them
+    qint64 dropped = 0; // superseded (waiting or in flight), or over budget
+    qint64 latency[latencyBuckets] = {}; // submit to completion, per bucket
+    qint64 latencyCount = 0;
+    qint64 latencySumNs = 0;
+};
+
+namespace detail {
+// Process-wide, shared by every Bounded.
+class Accounting {
+public:
+    static Accounting &instance() {
+        static Accounting a;
+        return a;
+    }
+
+    std::atomic<qint64> budget{qint64(256) << 20};
+    std::atomic<qint64> depth{0}, bytes{0}, dropped{0};
+
+    void recordLatency(qint64 ns) {
+        int b = 0;
+        while (b < latencyBuckets - 1 && ns > latencyBoundsMs[b] * 1000000) ++b;
+        ++latency[b];
+        ++count;
+        sumNs += ns;
+    }
+
+    QueueStats stats() const {
+        QueueStats s;
+        s.budget = budget;
+        s.depth = depth;
+        s.bytes = bytes;
+        s.dropped = dropped;
+        for (int b = 0; b < latencyBuckets; ++b) s.latency[b] = latency[b];
+        s.latencyCount = count;
+        s.latencySumNs = sumNs;
+        return s;
+    }
+
+private:
+    std::atomic<qint64> latency[latencyBuckets] = {};
+    std::atomic<qint64> count{0}, sumNs{0};
+};
+} // namespace detail
+
+inline void setByteBudget(qint64 bytes) { detail::Accounting::instance().budget = bytes; }
+inline QueueStats queueStats() { return detail::Accounting::instance().stats(); }
+
+class Bounded : public Backend {
+public:
+    static constexpr int minDelayMs = 100;
+    static constexpr int maxDelayMs = 10000;
+
+    explicit Bounded(std::unique_ptr<Backend> backend) : inner(std::move(backend)) {}
+    ~Bounded() override { waitForIdle(); }
+
+    const char *name() const override { return inner->name(); }
+
+    void submit(Job job, Done done) override {
+        detail::Accounting &acc = detail::Accounting::instance();
+        const qint64 bytes = qint64(job.text.size()) * qint64(sizeof(QChar));
+        Waiting w{std::move(job), std::move(done), QElapsedTimer(), bytes};
+        w.submitted.start();
+        std::optional<Waiting> replaced;
+        bool now = false, rejected = false;
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            PathState &st = paths[w.job.path];
+            if (st.next) {
+                replaced = std::move(st.next);
+                st.next.reset();
+                release(replaced->bytes);
+            }
+            if (!st.busy) {
+                st.busy = true; // always admitted, or nothing would ever be written
+                now = true;
+                arm(st, w, true);
+                acc.bytes += w.bytes;
+            } else if (!reserve(w.bytes)) {
+                rejected = true;
+            } else if (st.cancellable) {
+                st.writing.cancel(); // its successor is here
+            }
+            if (!rejected) {
+                ++acc.depth;
+                if (!now) st.next = std::move(w);
+            }
+        }
+        if (replaced) finish(*replaced, true);
+        if (rejected) finish(w, false);
+        if (now) start(std::move(w));
+    }
+
+    void waitForIdle() override {
+        {
+            std::unique_lock<std::mutex> lock(mu);
+            idle.wait(lock, [this]() { return paths.isEmpty(); });
+        }
+        inner->waitForIdle();
+    }
+
+    int suggestedDelayMs() const override {
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            if (paths.isEmpty()) return 0;
+        }
+        const detail::Accounting &acc = detail::Accounting::instance();
+        qint64 ms = 2 * avgLatencyNs / 1000000;
+        if (acc.bytes * 2 > acc.budget) ms *= 2; // half the budget is taken
+        return int(qBound<qint64>(minDelayMs, ms, maxDelayMs));
+    }
+
+private:
+    struct Waiting {
+        Job job;
+        Done done;
+        QElapsedTimer submitted;
+        qint64 bytes = 0;
+    };
+    struct PathState {
+        bool busy = false;           // a write is in flight
+        bool cancellable = false;    // a newer snapshot may cancel it
+        cancel::Source writing;      // its token
+        std::optional<Waiting> next; // newest snapshot behind it
+    };
+
+    std::unique_ptr<Backend> inner;
+    mutable std::mutex mu;
+    std::condition_variable idle;
+    QHash<QString, PathState> paths; // only paths with a write in flight
+    std::atomic<qint64> avgLatencyNs{0};
+
+    // Takes bytes from the budget unless that would overrun it. mu only
+    // guards this instance's paths, and the budget is shared by all of them.
+    static bool reserve(qint64 bytes) {
+        detail::Accounting &acc = detail::Accounting::instance();
+        qint64 held = acc.bytes.load();
+        do {
+            if (held + bytes > acc.budget) return false;
+        } while (!acc.bytes.compare_exchange_weak(held, held + bytes));
+        return true;
+    }
+
+    static void release(qint64 bytes) {
+        detail::Accounting &acc = detail::Accounting::instance();
+        acc.bytes -= bytes;
+        --acc.depth;
+    }
+
+    // Completes a snapshot that never reached the backend.
+    static void finish(const Waiting &w, bool superseded) {
+        ++detail::Accounting::instance().dropped;
+        Outcome o;
+        o.path = w.job.path;
+        o.ok = superseded;
+        o.superseded = superseded;
+        o.dropped = !superseded;
+        o.ns = w.submitted.nsecsElapsed();
+        w.done(o);
+    }
+
+    // Hands w the token of the write it is about to become (under mu).
+    static void arm(PathState &st, Waiting &w, bool cancellable) {
+        st.cancellable = cancellable;
+        w.job.saver->setCancelToken(cancellable ? st.writing.renew() : cancel::Token());
+    }
+
+    void start(Waiting w) {
+        const QString path = w.job.path;
+        inner->submit(std::move(w.job), [this, path, done = std::move(w.done), t = w.submitted, bytes = w.bytes](const Outcome &in) {
+            Outcome o = in;
+            o.ns = t.nsecsElapsed(); // including the time spent waiting here
+            release(bytes);
+            if (o.superseded) {
+                ++detail::Accounting::instance().dropped;
+            } else {
+                detail::Accounting::instance().recordLatency(o.ns);
+                const qint64 avg = avgLatencyNs;
+                avgLatencyNs = avg ? (avg * 7 + o.ns) / 8 : o.ns;
+            }
+            done(o);
+            std::optional<Waiting> next;
+            {
+                std::lock_guard<std::mutex> lock(mu);
+                PathState &st = paths[path];
+                if (st.next) {
+                    next = std::move(st.next);
+                    st.next.reset();
+                    arm(st, *next, !in.superseded);
+                } else {
+                    paths.remove(path);
+                    idle.notify_all();
+                }
+            }
+            if (next) start(std::move(*next));
+        });
+    }
+};
+
+// kind: auto, uring, threads or sync. Unknown or unavailable kinds fall back
+// to threads.
+inline std::unique_ptr<Backend> create(const QString &kind = QString("auto")) {
+    std::unique_ptr<Backend> b;
+    if (kind == "sync") b = std::make_unique<SyncBackend>();
+#ifdef OPI_HAVE_IO_URING
+    if (!b && (kind == "auto" || kind == "uring")) {
+        b = UringBackend::create();
+        if (!b && kind == "uring") qWarning("autosave: io_uring is not available, using the thread pool");
+    }
+#else
+    if (kind == "uring") qWarning("autosave: built without io_uring support, using the thread pool");
+#endif
+    if (!b) b = std::make_unique<ThreadPoolBackend>();
+    return std::make_unique<Bounded>(std::move(b));
+}
+
+} // namespace autosave
@@ -0,0 +1,13 @@
+QT -= gui
+CONFIG += console c++17
+CONFIG -= app_bundle
+TARGET = bench_autosave
+INCLUDEPATH += ../.. ../common
+HEADERS += ../../autosave.h ../../scheduler.h ../../formats.h ../../textwriter.h ../../textcodec.h ../../cpu.h ../../cancel.h ../../parsecache.h ../../durable.h ../../tracing.h ../common/harness.h ../common/corpus.h ../common/perfcounters.h
+SOURCES += main.cpp ../common/allochook.cpp
+win32: LIBS += -lpsapi
+linux:packagesExist(liburing) {
+    CONFIG += link_pkgconfig
+    PKGCONFIG += liburing
+    DEFINES += OPI_HAVE_IO_URING
+}
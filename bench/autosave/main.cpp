@@ -0,0 +1,113 @@
+// Autosave backend comparison. Submits a burst of autosaves to each backend
+// and reports how long submit() blocks the caller (what the GUI thread would
+// feel), the submit-to-completion latency and the sustained write throughput.
+//
+//   bench_autosave [--sizes 64K,4M,64M] [--saves 32] [--files 4] [--format txt]
+//                  [--backends sync,threads,uring] [--json out.json]
+//
+// Saves rotate over --files distinct paths; a path keeps one write in flight and
+// one waiting, so snapshots replaced behind it are reported as "dropped".
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <atomic>
+
+#include "autosave.h"
+#include "corpus.h"
+#include "harness.h"
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Autosave backend benchmark");
+    parser.addHelpOption();
+    QCommandLineOption sizesOpt("sizes", "Comma-separated document sizes.", "list", "64K,4M,64M");
+    QCommandLineOption savesOpt("saves", "Autosaves per backend and size.", "n", "32");
+    QCommandLineOption filesOpt("files", "Distinct target files.", "n", "4");
+    QCommandLineOption formatOpt("format", "Saver to use: txt, html or bin.", "ext", "txt");
+    QCommandLineOption backendsOpt("backends", "Backends to compare.", "list", "sync,threads,uring");
+    QCommandLineOption seedOpt("seed", "Corpus seed.", "n", "1");
+    QCommandLineOption jsonOpt("json", "Write results as JSON to file ('-' for stdout).", "file");
+    parser.addOptions({sizesOpt, savesOpt, filesOpt, formatOpt, backendsOpt, seedOpt, jsonOpt});
+    parser.process(app);
+
+    const int saves = qMax(1, parser.value(savesOpt).toInt());
+    const int files = qMax(1, parser.value(filesOpt).toInt());
+    const QString format = parser.value(formatOpt);
+    QTemporaryDir dir;
+    if (!dir.isValid()) return 1;
+
+    QTextStream err(stderr);
+    bench::Report report;
+    for (const QString &sizeStr : parser.value(sizesOpt).split(',', Qt::SkipEmptyParts)) {
+        const qint64 size = corpus::parseSize(sizeStr);
+        if (size < 0) {
+            qCritical("invalid size %s", qPrintable(sizeStr));
+            return 2;
+        }
+        corpus::Config cfg;
+        cfg.seed = parser.value(seedOpt).toULongLong();
+        cfg.size = size;
+        const QString text = QString::fromUtf8(corpus::generate(cfg));
+
+        for (const QString &kind : parser.value(backendsOpt).split(',', Qt::SkipEmptyParts)) {
+            std::unique_ptr<autosave::Backend> backend = autosave::create(kind);
+            if (kind != backend->name()) {
+                qWarning("backend %s unavailable, skipped", qPrintable(kind));
+                continue;
+            }
+            std::vector<qint64> submitNs, completionNs(size_t(saves), 0);
+            std::atomic<qint64> bytes{0};
+            std::atomic<int> failures{0}, dropped{0};
+            const long long allocs0 = benchAllocCount();
+            QElapsedTimer wall, t;
+            wall.start();
+            for (int i = 0; i < saves; ++i) {
+                autosave::Job job{dir.filePath(QString("doc-%1.%2").arg(i % files).arg(format)),
+                                  std::shared_ptr<IFileSaver>(factoryForExtension(format)->createSaver()), text};
+                t.start();
+                // Each callback writes its own slot; waitForIdle() orders them before the read below.
+                backend->submit(std::move(job), [&, i](const autosave::Outcome &o) {
+                    completionNs[size_t(i)] = o.ns;
+                    bytes += o.bytes;
+                    if (o.superseded || o.dropped) ++dropped;
+                    else if (!o.ok) ++failures;
+                });
+                submitNs.push_back(t.nsecsElapsed());
+            }
+            backend->waitForIdle();
+            const qint64 wallNs = wall.nsecsElapsed();
+
+            bench::LatencyResult submit;
+            submit.kernel = QString("autosave_submit_%1").arg(kind);
+            submit.size = size;
+            submit.setSamples(submitNs);
+            submit.allocsPerEvent = (benchAllocCount() - allocs0) / saves;
+            submit.extra["mb_per_s"] = wallNs > 0 ? double(bytes.load()) * 1000.0 / double(wallNs) : 0.0;
+            submit.extra["failures"] = failures.load();
+            submit.extra["dropped"] = dropped.load();
+            bench::LatencyResult done;
+            done.kernel = QString("autosave_complete_%1").arg(kind);
+            done.size = size;
+            done.setSamples(completionNs);
+            for (const bench::LatencyResult &r : {submit, done}) {
+                bench::Report::printRow(err, r);
+                report.add(r);
+            }
+            err << QString("%1 %2 %3 MB/s sustained\n").arg(QString(), -24).arg(QString(), 11)
+                       .arg(submit.extra["mb_per_s"].toDouble(), 10, 'f', 1);
+        }
+    }
+
+    if (parser.isSet(jsonOpt)) {
+        const QString out = parser.value(jsonOpt);
+        if (out == "-") {
+            QTextStream(stdout) << report.toJson().toJson(QJsonDocument::Indented);
+        } else if (!report.writeJson(out)) {
+            qCritical("cannot write %s", qPrintable(out));
+            return 1;
+        }
+    }
+    return 0;
+}
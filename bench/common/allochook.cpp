@@ -0,0 +1,52 @@
+// Process-wide allocation counters for the benchmark binaries.
+//
+// On glibc the C allocator is interposed, so QString/QByteArray storage
+// (which goes through malloc, not operator new) is counted as well.
+// Elsewhere only operator new is counted.
+#include <atomic>
+#include <cstddef>
+#include <new>
+
+namespace {
+std::atomic<long long> g_allocCount{0};
+std::atomic<long long> g_allocBytes{0};
+
+inline void countAlloc(std::size_t n) {
+    g_allocCount.fetch_add(1, std::memory_order_relaxed);
+    g_allocBytes.fetch_add(static_cast<long long>(n), std::memory_order_relaxed);
+}
+}
+
+long long benchAllocCount() { return g_allocCount.load(std::memory_order_relaxed); }
+long long benchAllocBytes() { return g_allocBytes.load(std::memory_order_relaxed); }
+
+#if defined(__GLIBC__)
+bool benchAllocCountsMalloc() { return true; }
+
+extern "C" {
+void *__libc_malloc(std::size_t);
+void *__libc_calloc(std::size_t, std::size_t);
+void *__libc_realloc(void *, std::size_t);
+void __libc_free(void *);
+
+void *malloc(std::size_t n) noexcept { countAlloc(n); return __libc_malloc(n); }
+void *calloc(std::size_t n, std::size_t m) noexcept { countAlloc(n * m); return __libc_calloc(n, m); }
+void *realloc(void *p, std::size_t n) noexcept { countAlloc(n); return __libc_realloc(p, n); }
+void free(void *p) noexcept { __libc_free(p); }
+}
+#else
+#include <cstdlib>
+
+bool benchAllocCountsMalloc() { return false; }
+
+void *operator new(std::size_t n) {
+    countAlloc(n);
+    if (void *p = std::malloc(n ? n : 1)) return p;
+    throw std::bad_alloc();
+}
+void *operator new[](std::size_t n) { return operator new(n); }
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+#endif
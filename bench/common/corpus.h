@@ -0,0 +1,224 @@
+#pragma once
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QtGlobal>
+#include <cmath>
+
+// Deterministic synthetic documents for benchmarks and fuzzing.
+// The same (Config, seed) always produces the same bytes on every platform:
+// only the portable splitmix64 generator and our own distributions are used.
+namespace corpus {
+
+enum class Format { Txt, Html, Bin };
+enum class LineEnding { LF, CRLF, Mixed };
+enum class LengthDist { Fixed, Uniform, Exponential };
+
+struct Config {
+    quint64 seed = 1;
+    qint64 size = qint64(1) << 20;     // approximate output size in bytes
+    Format format = Format::Txt;
+
+    LengthDist paraDist = LengthDist::Uniform;
+    int paraMinWords = 5;
+    int paraMaxWords = 120;
+    double paraMeanWords = 40;         // Fixed and Exponential
+
+    double blankRunProb = 0.1;         // chance of extra blank lines after a paragraph
+    int maxBlankRun = 4;
+    double cyrillicRatio = 0.5;        // share of Cyrillic words
+    LineEnding eol = LineEnding::LF;
+    double eolMixRatio = 0.5;          // share of CRLF when eol == Mixed
+
+    // HTML only
+    double tagDensity = 0.05;          // inline tags per word
+    double entityRate = 0.01;          // entities per word
+    double scriptStyleProb = 0.02;     // <script>/<style> blocks per paragraph
+
+    // BIN only
+    double invalidUtf8Rate = 0.0;      // broken sequences per paragraph
+};
+
+class Rng {
+    quint64 state;
+public:
+    explicit Rng(quint64 seed) : state(seed) {}
+    quint64 next() {
+        quint64 z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+    double real() { return double(next() >> 11) * (1.0 / 9007199254740992.0); }
+    int uniform(int lo, int hi) { return hi <= lo ? lo : lo + int(next() % quint64(hi - lo + 1)); }
+    bool chance(double p) { return p > 0 && real() < p; }
+    template <typename T, int N> const T &pick(const T (&arr)[N]) { return arr[next() % N]; }
+};
+
+namespace detail {
+
+inline const char *const asciiWords[] = {
+    "lorem", "ipsum", "dolor", "sit", "amet", "factory", "observer", "editor",
+    "paragraph", "file", "save", "load", "the", "a", "of", "and",
+    "document", "buffer", "line", "text", "quick", "brown", "fox", "jumps",
+};
+inline const char *const cyrillicWords[] = {
+    "текст", "абзац", "файл", "збереження", "редактор", "документ", "рядок", "слово",
+    "і", "та", "це", "що", "їжак", "ґанок", "єдність", "пісня",
+    "Київ", "Львів", "Харків", "Одеса", "швидкий", "лисиця", "стрибає", "через",
+};
+inline const char *const inlineTags[] = {"b", "i", "em", "strong", "span", "a", "code", "u"};
+inline const char *const entities[] = {"&amp;", "&lt;", "&gt;", "&nbsp;", "&quot;", "&#1046;", "&#x44F;", "&copy;"};
+inline const char *const scriptBlocks[] = {
+    "<script>if (a < b && c > d) { s = \"<p>not a paragraph</p>\"; }</script>",
+    "<style>p > b { color: red; } /* <br> */</style>",
+    "<script type=\"text/javascript\">\nfor (var i = 0; i < 10; i++) {}\n</script>",
+};
+
+class Writer {
+    const Config &cfg;
+    Rng &rng;
+public:
+    QByteArray out;
+    Writer(const Config &c, Rng &r) : cfg(c), rng(r) { out.reserve(c.size + 4096); }
+
+    void eol() {
+        bool crlf = cfg.eol == LineEnding::CRLF || (cfg.eol == LineEnding::Mixed && rng.chance(cfg.eolMixRatio));
+        out += crlf ? "\r\n" : "\n";
+    }
+    void word() {
+        if (rng.chance(cfg.cyrillicRatio)) out += rng.pick(cyrillicWords);
+        else out += rng.pick(asciiWords);
+    }
+    int paragraphWords() {
+        switch (cfg.paraDist) {
+        case LengthDist::Fixed: return qMax(1, int(cfg.paraMeanWords));
+        case LengthDist::Exponential: {
+            int n = int(-std::log(1.0 - rng.real()) * cfg.paraMeanWords);
+            return qBound(qMax(1, cfg.paraMinWords), n, qMax(1, cfg.paraMaxWords));
+        }
+        case LengthDist::Uniform: break;
+        }
+        return rng.uniform(qMax(1, cfg.paraMinWords), qMax(1, cfg.paraMaxWords));
+    }
+    void blankRun() {
+        if (!rng.chance(cfg.blankRunProb)) return;
+        for (int i = rng.uniform(1, qMax(1, cfg.maxBlankRun)); i > 0; --i) eol();
+    }
+};
+
+inline void textParagraph(Writer &w, Rng &rng, const Config &cfg) {
+    const int words = w.paragraphWords();
+    int lineLen = 0;
+    for (int i = 0; i < words; ++i) {
+        if (i) {
+            // Long paragraphs are hard-wrapped like typical plain-text files.
+            if (lineLen > 72) { w.eol(); lineLen = 0; }
+            else { w.out += ' '; ++lineLen; }
+        }
+        const qsizetype before = w.out.size();
+        w.word();
+        lineLen += int(w.out.size() - before);
+    }
+    if (cfg.format == Format::Bin && rng.chance(cfg.invalidUtf8Rate)) {
+        static const char broken[][3] = {{'\xC3', 0, 0}, {'\xE2', '\x82', 0}, {'\xFF', 0, 0}, {'\xC0', '\xAF', 0}};
+        w.out += rng.pick(broken);
+    }
+}
+
+inline void htmlParagraph(Writer &w, Rng &rng, const Config &cfg) {
+    if (rng.chance(cfg.scriptStyleProb)) { w.out += rng.pick(scriptBlocks); w.eol(); }
+    w.out += rng.chance(0.2) ? "<p class=\"para\">" : "<p>";
+    const int words = w.paragraphWords();
+    const char *open = nullptr;
+    for (int i = 0; i < words; ++i) {
+        if (i) w.out += ' ';
+        if (!open && rng.chance(cfg.tagDensity)) {
+            open = rng.pick(inlineTags);
+            w.out += '<';
+            w.out += open;
+            if (qstrcmp(open, "a") == 0) w.out += " href=\"#x\"";
+            w.out += '>';
+        }
+        if (rng.chance(cfg.entityRate)) w.out += rng.pick(entities);
+        else w.word();
+        if (open && rng.chance(0.3)) { w.out += "</"; w.out += open; w.out += '>'; open = nullptr; }
+        if (rng.chance(cfg.tagDensity * 0.1)) w.out += "<br>";
+        if (i && i % 12 == 0) w.eol();
+    }
+    if (open) { w.out += "</"; w.out += open; w.out += '>'; }
+    w.out += "</p>";
+}
+
+} // namespace detail
+
+inline QByteArray generate(const Config &cfg) {
+    Rng rng(cfg.seed);
+    detail::Writer w(cfg, rng);
+    const bool html = cfg.format == Format::Html;
+    if (html) {
+        w.out += "<!DOCTYPE html>";
+        w.eol();
+        w.out += "<html><head><meta charset=\"utf-8\"><title>corpus</title></head><body>";
+        w.eol();
+    }
+    while (w.out.size() < cfg.size) {
+        if (html) detail::htmlParagraph(w, rng, cfg);
+        else detail::textParagraph(w, rng, cfg);
+        w.eol();
+        if (!html) w.eol();
+        w.blankRun();
+    }
+    if (html) {
+        w.out += "</body></html>";
+        w.eol();
+    }
+    return w.out;
+}
+
+// "64K", "16M", "1G" or plain bytes; -1 when malformed.
+inline qint64 parseSize(const QString &s) {
+    QString v = s.trimmed().toUpper();
+    qint64 mul = 1;
+    if (v.endsWith('K')) mul = qint64(1) << 10;
+    else if (v.endsWith('M')) mul = qint64(1) << 20;
+    else if (v.endsWith('G')) mul = qint64(1) << 30;
+    if (mul != 1) v.chop(1);
+    bool ok = false;
+    qint64 n = v.toLongLong(&ok);
+    return ok ? n * mul : -1;
+}
+
+inline QString formatSuffix(Format f) {
+    switch (f) {
+    case Format::Html: return "html";
+    case Format::Bin: return "bin";
+    case Format::Txt: break;
+    }
+    return "txt";
+}
+
+// Fuzz seeds vary every knob, so they are derived from the seed alone.
+inline Config fuzzConfig(quint64 seed, qint64 maxSize) {
+    Rng rng(seed ^ 0xF022F022F022F022ull);
+    Config c;
+    c.seed = seed;
+    c.size = rng.uniform(0, int(qMin<qint64>(maxSize, 1 << 30)));
+    c.format = Format(rng.uniform(0, 2));
+    c.paraDist = LengthDist(rng.uniform(0, 2));
+    c.paraMinWords = rng.uniform(1, 10);
+    c.paraMaxWords = rng.uniform(c.paraMinWords, 300);
+    c.paraMeanWords = rng.uniform(1, 80);
+    c.blankRunProb = rng.real();
+    c.maxBlankRun = rng.uniform(1, 8);
+    c.cyrillicRatio = rng.real();
+    c.eol = LineEnding(rng.uniform(0, 2));
+    c.tagDensity = rng.real() * 0.5;
+    c.entityRate = rng.real() * 0.2;
+    c.scriptStyleProb = rng.real() * 0.3;
+    c.invalidUtf8Rate = rng.real() * 0.2;
+    return c;
+}
+
+} // namespace corpus
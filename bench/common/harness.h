@@ -0,0 +1,282 @@
+#pragma once
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QString>
+#include <QSysInfo>
+#include <QTextStream>
+#include <QtGlobal>
+#include <algorithm>
+#include <vector>
+
+#include "cpu.h"
+#include "perfcounters.h"
+
+#if defined(Q_OS_WIN)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#elif defined(Q_OS_UNIX)
+#include <sys/resource.h>
+#endif
+
+// Defined in allochook.cpp
+long long benchAllocCount();
+long long benchAllocBytes();
+bool benchAllocCountsMalloc();
+
+namespace bench {
+
+// ---------------- Memory ----------------
+#if defined(Q_OS_LINUX)
+inline qint64 procStatusKb(const char *field) {
+    QFile f("/proc/self/status");
+    if (!f.open(QIODevice::ReadOnly)) return -1;
+    const QByteArray key = QByteArray(field) + ':';
+    for (const QByteArray &line : f.readAll().split('\n')) {
+        if (line.startsWith(key)) return line.mid(key.size()).trimmed().split(' ').value(0).toLongLong();
+    }
+    return -1;
+}
+#endif
+
+inline qint64 currentRssKb() {
+#if defined(Q_OS_LINUX)
+    return procStatusKb("VmRSS");
+#elif defined(Q_OS_WIN)
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) return -1;
+    return qint64(pmc.WorkingSetSize / 1024);
+#else
+    return -1;
+#endif
+}
+
+inline qint64 peakRssKb() {
+#if defined(Q_OS_LINUX)
+    return procStatusKb("VmHWM");
+#elif defined(Q_OS_WIN)
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) return -1;
+    return qint64(pmc.PeakWorkingSetSize / 1024);
+#elif defined(Q_OS_UNIX)
+    rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0) return -1;
+#if defined(Q_OS_DARWIN)
+    return qint64(ru.ru_maxrss / 1024);
+#else
+    return qint64(ru.ru_maxrss);
+#endif
+#else
+    return -1;
+#endif
+}
+
+// Resets the high-water mark so the next peakRssKb() covers one kernel only.
+// Only Linux supports this; elsewhere the peak is process-wide.
+inline bool resetPeakRss() {
+#if defined(Q_OS_LINUX)
+    QFile f("/proc/self/clear_refs");
+    if (!f.open(QIODevice::WriteOnly)) return false;
+    return f.write("5") == 1;
+#else
+    return false;
+#endif
+}
+
+// ---------------- Measurement ----------------
+struct Options {
+    qint64 minTimeMs = 200;
+    int maxIterations = 1000;
+    PerfCounters *counters = nullptr; // optional, read around the first timed run
+};
+
+struct Result {
+    QString kernel;
+    qint64 size = 0;           // nominal input size of the row
+    qint64 bytes = 0;          // bytes processed per iteration
+    int iterations = 0;
+    qint64 medianNs = 0;
+    qint64 minNs = 0;
+    qint64 allocs = -1;        // per iteration
+    qint64 allocBytes = -1;
+    qint64 peakRssKb = -1;
+    qint64 peakRssDeltaKb = -1;
+    qint64 perf[PerfCounters::EventCount] = {-1, -1, -1, -1, -1};
+
+    double mbPerSec() const { return medianNs > 0 ? double(bytes) * 1000.0 / double(medianNs) : 0.0; }
+
+    QJsonObject toJson() const {
+        QJsonObject o;
+        o["kernel"] = kernel;
+        o["size"] = size;
+        o["bytes"] = bytes;
+        o["iterations"] = iterations;
+        o["median_ns"] = medianNs;
+        o["min_ns"] = minNs;
+        o["mb_per_s"] = mbPerSec();
+        o["allocs"] = allocs;
+        o["alloc_bytes"] = allocBytes;
+        o["peak_rss_kb"] = peakRssKb;
+        o["peak_rss_delta_kb"] = peakRssDeltaKb;
+        for (int i = 0; i < PerfCounters::EventCount; ++i) {
+            const QString name = PerfCounters::name(PerfCounters::Event(i));
+            o[name] = perf[i];
+            o[name + "_per_byte"] = perf[i] >= 0 && bytes > 0 ? double(perf[i]) / double(bytes) : -1.0;
+        }
+        return o;
+    }
+};
+
+inline void doNotOptimize(qint64 v) {
+    static volatile qint64 sink;
+    sink = v;
+}
+
+// Runs fn until opt.minTimeMs has elapsed (at least once). The first timed
+// run also records allocations, peak RSS and, if enabled, CPU counters.
+// fn returns any value derived from its output so the work cannot be
+// optimised away.
+template <typename Fn>
+Result measure(const QString &kernel, qint64 size, qint64 bytes, const Options &opt, Fn &&fn) {
+    Result r;
+    r.kernel = kernel;
+    r.size = size;
+    r.bytes = bytes;
+
+    if (bytes < (qint64(64) << 20)) doNotOptimize(fn()); // warm-up, too slow for huge inputs
+
+    const bool rssReset = resetPeakRss();
+    const qint64 rssBefore = currentRssKb();
+    const long long allocs0 = benchAllocCount();
+    const long long allocBytes0 = benchAllocBytes();
+
+    std::vector<qint64> times;
+    QElapsedTimer total;
+    total.start();
+    QElapsedTimer t;
+    if (opt.counters) opt.counters->start();
+    t.start();
+    doNotOptimize(fn());
+    times.push_back(t.nsecsElapsed());
+    if (opt.counters) {
+        opt.counters->stop();
+        for (int i = 0; i < PerfCounters::EventCount; ++i) r.perf[i] = opt.counters->value(PerfCounters::Event(i));
+    }
+
+    r.allocs = benchAllocCount() - allocs0;
+    r.allocBytes = benchAllocBytes() - allocBytes0;
+    r.peakRssKb = peakRssKb();
+    if (rssReset && rssBefore >= 0 && r.peakRssKb >= 0) r.peakRssDeltaKb = r.peakRssKb - rssBefore;
+
+    while (total.elapsed() < opt.minTimeMs && int(times.size()) < opt.maxIterations) {
+        t.restart();
+        doNotOptimize(fn());
+        times.push_back(t.nsecsElapsed());
+    }
+
+    std::sort(times.begin(), times.end());
+    r.iterations = int(times.size());
+    r.minNs = times.front();
+    r.medianNs = times[times.size() / 2];
+    return r;
+}
+
+// ---------------- Latency ----------------
+// Distribution of per-event latencies, e.g. one keystroke each.
+struct LatencyResult {
+    QString kernel;
+    qint64 size = 0;
+    int events = 0;
+    qint64 p50Ns = 0;
+    qint64 p99Ns = 0;
+    qint64 maxNs = 0;
+    qint64 allocsPerEvent = -1;
+    QJsonObject extra;         // benchmark-specific counters
+
+    static qint64 percentile(const std::vector<qint64> &sorted, double q) {
+        if (sorted.empty()) return 0;
+        size_t idx = size_t(q * double(sorted.size()));
+        return sorted[qMin(idx, sorted.size() - 1)];
+    }
+
+    void setSamples(std::vector<qint64> samples) {
+        std::sort(samples.begin(), samples.end());
+        events = int(samples.size());
+        p50Ns = percentile(samples, 0.50);
+        p99Ns = percentile(samples, 0.99);
+        maxNs = samples.empty() ? 0 : samples.back();
+    }
+
+    QJsonObject toJson() const {
+        QJsonObject o = extra;
+        o["kernel"] = kernel;
+        o["size"] = size;
+        o["events"] = events;
+        o["p50_ns"] = p50Ns;
+        o["p99_ns"] = p99Ns;
+        o["max_ns"] = maxNs;
+        o["allocs_per_event"] = allocsPerEvent;
+        return o;
+    }
+};
+
+// ---------------- Reporting ----------------
+class Report {
+    QJsonArray results;
+public:
+    void add(const Result &r) { results.append(r.toJson()); }
+    void add(const LatencyResult &r) { results.append(r.toJson()); }
+
+    QJsonDocument toJson() const {
+        QJsonObject root;
+        root["schema"] = 1;
+        root["host"] = QSysInfo::machineHostName();
+        root["cpu_arch"] = QSysInfo::currentCpuArchitecture();
+        root["cpu_level"] = cpu::levelName(cpu::level());
+        root["qt"] = QString(qVersion());
+        root["alloc_counts_malloc"] = benchAllocCountsMalloc();
+        root["results"] = results;
+        return QJsonDocument(root);
+    }
+
+    bool writeJson(const QString &path) const {
+        QFile f(path);
+        if (!f.open(QIODevice::WriteOnly)) return false;
+        return f.write(toJson().toJson(QJsonDocument::Indented)) >= 0;
+    }
+
+    static void printRow(QTextStream &out, const Result &r) {
+        out << QString("%1 %2 %3 MB/s %4 allocs %5 KB peak")
+                   .arg(r.kernel, -16)
+                   .arg(r.size, 11)
+                   .arg(r.mbPerSec(), 10, 'f', 1)
+                   .arg(r.allocs, 10)
+                   .arg(r.peakRssDeltaKb, 10);
+        const qint64 cycles = r.perf[PerfCounters::Cycles], insns = r.perf[PerfCounters::Instructions];
+        if (cycles > 0 && r.bytes > 0) {
+            out << QString(" %1 cyc/B").arg(double(cycles) / double(r.bytes), 8, 'f', 2);
+            if (insns >= 0) out << QString(" IPC %1").arg(double(insns) / double(cycles), 5, 'f', 2);
+        }
+        out << '\n';
+        out.flush();
+    }
+
+    static void printRow(QTextStream &out, const LatencyResult &r) {
+        out << QString("%1 %2 p50 %3 us  p99 %4 us  max %5 us  (%6 events)\n")
+                   .arg(r.kernel, -24)
+                   .arg(r.size, 11)
+                   .arg(r.p50Ns / 1000.0, 9, 'f', 1)
+                   .arg(r.p99Ns / 1000.0, 9, 'f', 1)
+                   .arg(r.maxNs / 1000.0, 9, 'f', 1)
+                   .arg(r.events);
+        out.flush();
+    }
+};
+
+} // namespace bench
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <QtGlobal>
+
+#if defined(Q_OS_LINUX)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+#endif
+
+namespace bench {
+
+// Hardware/software counters of the calling thread via perf_event_open.
+// Each event is opened on its own so a VM without a PMU still gets page
+// faults; anything that cannot be opened reads as -1. On non-Linux
+// platforms nothing is available.
+class PerfCounters {
+public:
+    enum Event { Cycles, Instructions, CacheMisses, BranchMisses, PageFaults, EventCount };
+
+    static const char *name(Event e) {
+        static const char *const names[EventCount] = {"cycles", "instructions", "cache_misses", "branch_misses", "page_faults"};
+        return names[e];
+    }
+
+    PerfCounters() {
+        for (int i = 0; i < EventCount; ++i) {
+            fds[i] = -1;
+            vals[i] = -1;
+        }
+#if defined(Q_OS_LINUX)
+        static const struct { quint32 type; quint64 config; } events[EventCount] = {
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+            {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+        };
+        for (int i = 0; i < EventCount; ++i) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = events[i].type;
+            attr.config = events[i].config;
+            attr.disabled = 1;
+            attr.exclude_kernel = 1; // works with perf_event_paranoid=2
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            fds[i] = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+#endif
+    }
+
+    ~PerfCounters() {
+#if defined(Q_OS_LINUX)
+        for (int fd : fds)
+            if (fd >= 0) close(fd);
+#endif
+    }
+
+    PerfCounters(const PerfCounters &) = delete;
+    PerfCounters &operator=(const PerfCounters &) = delete;
+
+    bool available() const {
+        for (int fd : fds)
+            if (fd >= 0) return true;
+        return false;
+    }
+    bool available(Event e) const { return fds[e] >= 0; }
+
+    void start() {
+#if defined(Q_OS_LINUX)
+        for (int fd : fds) {
+            if (fd < 0) continue;
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    void stop() {
+#if defined(Q_OS_LINUX)
+        for (int fd : fds)
+            if (fd >= 0) ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        for (int i = 0; i < EventCount; ++i) {
+            vals[i] = -1;
+            quint64 buf[3]; // value, time enabled, time running
+            if (fds[i] < 0 || read(fds[i], buf, sizeof(buf)) != ssize_t(sizeof(buf))) continue;
+            // Never scheduled (multiplexed out for the whole window): no reading,
+            // not a zero count.
+            if (buf[2] == 0) continue;
+            // Scale up if the kernel multiplexed the counter.
+            vals[i] = buf[2] < buf[1] ? qint64(double(buf[0]) * double(buf[1]) / double(buf[2])) : qint64(buf[0]);
+        }
+#endif
+    }
+
+    // Value from the last start()/stop() window, or -1.
+    qint64 value(Event e) const { return vals[e]; }
+
+private:
+    int fds[EventCount];
+    qint64 vals[EventCount];
+};
+
+} // namespace bench
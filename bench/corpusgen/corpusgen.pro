@@ -0,0 +1,7 @@
+QT -= gui
+CONFIG += console c++17
+CONFIG -= app_bundle
+TARGET = corpusgen
+INCLUDEPATH += ../common
+HEADERS += ../common/corpus.h
+SOURCES += main.cpp
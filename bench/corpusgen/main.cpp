@@ -0,0 +1,92 @@
+// Writes deterministic synthetic TXT/HTML/BIN documents (see corpus.h).
+//
+//   corpusgen --format html --size 64M --seed 7 -o big.html
+//   corpusgen --fuzz-seeds 200 --max-size 64K --out-dir seeds/
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+
+#include "corpus.h"
+
+static bool writeFile(const QString &path, const QByteArray &bytes) {
+    QFile f(path);
+    if (!f.open(QIODevice::WriteOnly) || f.write(bytes) != bytes.size()) {
+        qCritical("cannot write %s", qPrintable(path));
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    QCommandLineParser p;
+    p.setApplicationDescription("Deterministic corpus generator for benchmarks and fuzzing");
+    p.addHelpOption();
+    QCommandLineOption formatOpt("format", "txt, html or bin.", "fmt", "txt");
+    QCommandLineOption sizeOpt("size", "Approximate output size (1K, 64M, 1G...).", "size", "1M");
+    QCommandLineOption seedOpt("seed", "Random seed.", "n", "1");
+    QCommandLineOption outOpt(QStringList{"o", "output"}, "Output file.", "file");
+    QCommandLineOption distOpt("para-dist", "Paragraph length: fixed, uniform or exp.", "dist", "uniform");
+    QCommandLineOption minWordsOpt("para-min", "Minimum words per paragraph.", "n", "5");
+    QCommandLineOption maxWordsOpt("para-max", "Maximum words per paragraph.", "n", "120");
+    QCommandLineOption meanWordsOpt("para-mean", "Mean words per paragraph (fixed/exp).", "n", "40");
+    QCommandLineOption blankProbOpt("blank-prob", "Chance of an extra blank-line run.", "p", "0.1");
+    QCommandLineOption blankRunOpt("blank-run", "Longest extra blank-line run.", "n", "4");
+    QCommandLineOption cyrOpt("cyrillic", "Share of Cyrillic words, 0..1.", "p", "0.5");
+    QCommandLineOption eolOpt("eol", "lf, crlf or mixed.", "eol", "lf");
+    QCommandLineOption tagOpt("tag-density", "HTML inline tags per word.", "p", "0.05");
+    QCommandLineOption entityOpt("entity-rate", "HTML entities per word.", "p", "0.01");
+    QCommandLineOption scriptOpt("script-prob", "HTML script/style blocks per paragraph.", "p", "0.02");
+    QCommandLineOption invalidOpt("invalid-utf8", "BIN broken UTF-8 sequences per paragraph.", "p", "0");
+    QCommandLineOption fuzzOpt("fuzz-seeds", "Write N fuzz seeds with randomised settings.", "n");
+    QCommandLineOption maxSizeOpt("max-size", "Largest fuzz seed.", "size", "64K");
+    QCommandLineOption dirOpt("out-dir", "Directory for fuzz seeds.", "dir", ".");
+    p.addOptions({formatOpt, sizeOpt, seedOpt, outOpt, distOpt, minWordsOpt, maxWordsOpt, meanWordsOpt,
+                  blankProbOpt, blankRunOpt, cyrOpt, eolOpt, tagOpt, entityOpt, scriptOpt, invalidOpt,
+                  fuzzOpt, maxSizeOpt, dirOpt});
+    p.process(app);
+
+    const quint64 seed = p.value(seedOpt).toULongLong();
+
+    if (p.isSet(fuzzOpt)) {
+        const int n = p.value(fuzzOpt).toInt();
+        const qint64 maxSize = corpus::parseSize(p.value(maxSizeOpt));
+        QDir dir(p.value(dirOpt));
+        if (!dir.mkpath(".") || maxSize < 0) return 2;
+        for (int i = 0; i < n; ++i) {
+            const corpus::Config c = corpus::fuzzConfig(seed + quint64(i), maxSize);
+            const QString name = QString("seed-%1.%2").arg(i, 5, 10, QChar('0')).arg(corpus::formatSuffix(c.format));
+            if (!writeFile(dir.filePath(name), corpus::generate(c))) return 1;
+        }
+        return 0;
+    }
+
+    corpus::Config c;
+    c.seed = seed;
+    c.size = corpus::parseSize(p.value(sizeOpt));
+    const QString fmt = p.value(formatOpt).toLower();
+    c.format = fmt == "html" ? corpus::Format::Html : fmt == "bin" ? corpus::Format::Bin : corpus::Format::Txt;
+    const QString dist = p.value(distOpt).toLower();
+    c.paraDist = dist == "fixed" ? corpus::LengthDist::Fixed
+               : dist == "exp" ? corpus::LengthDist::Exponential : corpus::LengthDist::Uniform;
+    c.paraMinWords = p.value(minWordsOpt).toInt();
+    c.paraMaxWords = p.value(maxWordsOpt).toInt();
+    c.paraMeanWords = p.value(meanWordsOpt).toDouble();
+    c.blankRunProb = p.value(blankProbOpt).toDouble();
+    c.maxBlankRun = p.value(blankRunOpt).toInt();
+    c.cyrillicRatio = p.value(cyrOpt).toDouble();
+    const QString eol = p.value(eolOpt).toLower();
+    c.eol = eol == "crlf" ? corpus::LineEnding::CRLF : eol == "mixed" ? corpus::LineEnding::Mixed : corpus::LineEnding::LF;
+    c.tagDensity = p.value(tagOpt).toDouble();
+    c.entityRate = p.value(entityOpt).toDouble();
+    c.scriptStyleProb = p.value(scriptOpt).toDouble();
+    c.invalidUtf8Rate = p.value(invalidOpt).toDouble();
+    if (c.size < 0) {
+        qCritical("invalid size");
+        return 2;
+    }
+
+    const QString out = p.isSet(outOpt) ? p.value(outOpt) : QString("corpus-%1.%2").arg(seed).arg(corpus::formatSuffix(c.format));
+    return writeFile(out, corpus::generate(c)) ? 0 : 1;
+}
@@ -0,0 +1,5 @@
+QT -= gui
+CONFIG += console c++17
+CONFIG -= app_bundle
+TARGET = bench_gate
+SOURCES += main.cpp
@@ -0,0 +1,241 @@
+// Performance regression gate. Runs the benchmark binaries listed in the
+// config (or takes existing result files), compares every tracked metric with
+// the baseline recorded on this machine and exits non-zero on a regression.
+//
+//   bench_gate --baseline ref.json --bin-dir build/bench --update   (once, on the reference machine)
+//   bench_gate --baseline ref.json --bin-dir build/bench
+//   bench_gate --baseline ref.json --results kernels.json latency.json
+//
+// The config (bench/gate.json: runs and tolerances) is the same everywhere;
+// the baseline holds machine-specific numbers and is created by --update. A
+// metric the baseline has no value for fails the gate as well, so a stale
+// baseline cannot pass silently; --allow-new accepts them.
+//
+// Exit codes: 0 no regression, 1 regression or unbaselined metric, 2 usage,
+// missing baseline or benchmark failure.
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMap>
+#include <QProcess>
+#include <QTemporaryDir>
+#include <QTextStream>
+
+namespace {
+
+struct MetricSpec {
+    const char *name;
+    bool higherIsBetter;
+};
+
+// Metrics the gate tracks; anything else in the result files is ignored.
+const MetricSpec trackedMetrics[] = {
+    {"mb_per_s", true},
+    {"peak_rss_delta_kb", false},
+    {"allocs", false},
+    {"p99_ns", false},
+    {"allocs_per_event", false},
+};
+
+struct Tolerance {
+    double rel = 0.10;   // allowed relative change in the bad direction
+    double abs = 0.0;    // plus this much absolute slack (noise floor)
+};
+
+Tolerance parseTolerance(const QJsonValue &v, Tolerance def) {
+    if (v.isDouble()) def.rel = v.toDouble();
+    else if (v.isObject()) {
+        const QJsonObject o = v.toObject();
+        def.rel = o.value("rel").toDouble(def.rel);
+        def.abs = o.value("abs").toDouble(def.abs);
+    }
+    return def;
+}
+
+// "kernel/size" -> metric -> value
+using Metrics = QMap<QString, QMap<QString, double>>;
+
+void collect(const QJsonDocument &doc, Metrics &out) {
+    for (const QJsonValue &v : doc.object().value("results").toArray()) {
+        const QJsonObject r = v.toObject();
+        const QString key = QString("%1/%2").arg(r.value("kernel").toString()).arg(qint64(r.value("size").toDouble()));
+        for (const MetricSpec &m : trackedMetrics) {
+            const QJsonValue mv = r.value(m.name);
+            // -1 marks a metric the platform could not measure.
+            if (mv.isDouble() && mv.toDouble() >= 0) out[key][m.name] = mv.toDouble();
+        }
+    }
+}
+
+bool readJson(const QString &path, QJsonDocument &doc) {
+    QFile f(path);
+    if (!f.open(QIODevice::ReadOnly)) return false;
+    QJsonParseError err;
+    doc = QJsonDocument::fromJson(f.readAll(), &err);
+    return err.error == QJsonParseError::NoError && doc.isObject();
+}
+
+bool runBenchmarks(const QJsonObject &runs, const QString &binDir, const QString &outDir, QStringList &results) {
+    for (auto it = runs.begin(); it != runs.end(); ++it) {
+        QString exe = QDir(binDir).filePath(it.key());
+#ifdef Q_OS_WIN
+        exe += ".exe";
+#endif
+        const QString json = QDir(outDir).filePath(it.key() + ".json");
+        QStringList args;
+        for (const QJsonValue &a : it.value().toArray()) args << a.toString();
+        args << "--json" << json;
+        QTextStream(stderr) << "running " << exe << ' ' << args.join(' ') << '\n';
+        QProcess p;
+        p.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+        p.start(exe, args);
+        if (!p.waitForFinished(-1) || p.exitStatus() != QProcess::NormalExit || p.exitCode() != 0) {
+            QTextStream(stderr) << it.key() << " failed: " << p.errorString() << '\n';
+            return false;
+        }
+        results << json;
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Benchmark regression gate");
+    parser.addHelpOption();
+    QCommandLineOption configOpt("config", "Runs and tolerances (default: bench/gate.json).", "file", "bench/gate.json");
+    QCommandLineOption baselineOpt("baseline", "Baseline JSON file for this machine; --update creates it.", "file");
+    QCommandLineOption binDirOpt("bin-dir", "Directory with the benchmark executables.", "dir");
+    QCommandLineOption resultsOpt("results", "Compare these result files instead of running benchmarks.");
+    QCommandLineOption updateOpt("update", "Rewrite the baseline metrics with the current results.");
+    QCommandLineOption allowNewOpt("allow-new", "Do not fail on metrics the baseline has no value for.");
+    parser.addOptions({configOpt, baselineOpt, binDirOpt, resultsOpt, updateOpt, allowNewOpt});
+    parser.addPositionalArgument("files", "Result files for --results.");
+    parser.process(app);
+
+    QTextStream out(stdout);
+    QJsonDocument configDoc;
+    if (!readJson(parser.value(configOpt), configDoc)) {
+        QTextStream(stderr) << "cannot read " << parser.value(configOpt) << '\n';
+        return 2;
+    }
+    const QJsonObject config = configDoc.object();
+    if (!parser.isSet(baselineOpt)) {
+        QTextStream(stderr) << "--baseline is required\n";
+        return 2;
+    }
+    const QString baselinePath = parser.value(baselineOpt);
+    QJsonDocument baselineDoc;
+    if (!readJson(baselinePath, baselineDoc)) {
+        if (!parser.isSet(updateOpt) || QFile::exists(baselinePath)) {
+            QTextStream(stderr) << "cannot read baseline " << baselinePath
+                                << "; record one on the reference machine with --update\n";
+            return 2;
+        }
+        baselineDoc = QJsonDocument(QJsonObject{{"schema", 1}});
+    }
+    QJsonObject baseline = baselineDoc.object();
+
+    QTemporaryDir tmp;
+    QStringList resultFiles;
+    if (parser.isSet(resultsOpt)) {
+        resultFiles = parser.positionalArguments();
+    } else if (!parser.isSet(binDirOpt) || !tmp.isValid()
+               || !runBenchmarks(config.value("runs").toObject(), parser.value(binDirOpt), tmp.path(), resultFiles)) {
+        return 2;
+    }
+
+    Metrics current;
+    for (const QString &f : resultFiles) {
+        QJsonDocument doc;
+        if (!readJson(f, doc)) {
+            QTextStream(stderr) << "cannot read " << f << '\n';
+            return 2;
+        }
+        collect(doc, current);
+    }
+
+    if (parser.isSet(updateOpt)) {
+        QJsonObject metrics;
+        for (auto it = current.begin(); it != current.end(); ++it) {
+            QJsonObject m = baseline.value("metrics").toObject().value(it.key()).toObject();
+            for (auto mt = it.value().begin(); mt != it.value().end(); ++mt) m[mt.key()] = mt.value();
+            metrics[it.key()] = m;
+        }
+        baseline["metrics"] = metrics;
+        QFile f(baselinePath);
+        if (!f.open(QIODevice::WriteOnly) || f.write(QJsonDocument(baseline).toJson(QJsonDocument::Indented)) < 0) return 2;
+        out << "baseline updated: " << metrics.size() << " benchmarks\n";
+        return 0;
+    }
+
+    const QJsonObject tolerances = config.value("tolerances").toObject();
+    const QJsonObject stored = baseline.value("metrics").toObject();
+    const bool allowNew = parser.isSet(allowNewOpt);
+    int regressions = 0, unbaselined = 0;
+    out << QString("%1 %2 %3 %4 %5 %6  %7\n")
+               .arg(QString("benchmark"), -30).arg(QString("metric"), -18).arg(QString("baseline"), 14)
+               .arg(QString("current"), 14).arg(QString("change"), 9).arg(QString("allowed"), 12).arg(QString("status"));
+
+    // Every baseline entry must still be produced, plus anything new.
+    QStringList keys = stored.keys();
+    for (const QString &k : current.keys())
+        if (!keys.contains(k)) keys << k;
+    keys.sort();
+
+    for (const QString &key : keys) {
+        const QJsonObject base = stored.value(key).toObject();
+        const QJsonObject perEntry = base.value("tolerance").toObject();
+        for (const MetricSpec &m : trackedMetrics) {
+            const bool hasBase = base.contains(m.name);
+            const bool hasCur = current.value(key).contains(m.name);
+            if (!hasBase && !hasCur) continue;
+            const Tolerance tol = parseTolerance(perEntry.value(m.name), parseTolerance(tolerances.value(m.name), Tolerance()));
+            const double b = base.value(m.name).toDouble();
+            const double c = current.value(key).value(m.name);
+
+            // How far the metric may move in the bad direction.
+            const double allowed = tol.rel * qAbs(b) + tol.abs;
+            QString status, change = "-";
+            if (!hasCur) {
+                status = "MISSING";
+                ++regressions;
+            } else if (!hasBase) {
+                status = allowNew ? "new" : "NO BASELINE";
+                if (!allowNew) ++unbaselined;
+            } else {
+                const double rel = b != 0 ? (c - b) / b : (c == 0 ? 0.0 : 1.0);
+                change = QString("%1%2%").arg(QString(rel >= 0 ? "+" : "")).arg(rel * 100, 0, 'f', 1);
+                // Positive `worse` means the metric moved in the bad direction.
+                const double worse = m.higherIsBetter ? b - c : c - b;
+                if (worse > allowed) {
+                    status = "REGRESSED";
+                    ++regressions;
+                } else if (-worse > allowed) {
+                    status = "improved";
+                } else {
+                    status = "ok";
+                }
+            }
+            out << QString("%1 %2 %3 %4 %5 %6  %7\n")
+                       .arg(key, -30).arg(QString(m.name), -18)
+                       .arg(hasBase ? QString::number(b, 'g', 6) : QString("-"), 14)
+                       .arg(hasCur ? QString::number(c, 'g', 6) : QString("-"), 14)
+                       .arg(change, 9)
+                       .arg(hasBase ? QString::number(allowed, 'g', 6) : QString("-"), 12)
+                       .arg(status);
+        }
+    }
+
+    out << (regressions ? QString("\n%1 regression(s)\n").arg(regressions) : QString("\nno regressions\n"));
+    if (unbaselined)
+        out << QString("%1 metric(s) without a baseline: re-record the baseline with --update, "
+                       "or pass --allow-new\n").arg(unbaselined);
+    return regressions || unbaselined ? 1 : 0;
+}
@@ -0,0 +1,8 @@
+QT -= gui
+CONFIG += console c++17
+CONFIG -= app_bundle
+TARGET = bench_kernels
+INCLUDEPATH += ../.. ../common
+HEADERS += ../../formats.h ../../textwriter.h ../../textcodec.h ../../cpu.h ../../cancel.h ../../parsecache.h ../../docstats.h ../../diff.h ../../scheduler.h ../../durable.h ../../tracing.h ../common/harness.h ../common/corpus.h ../common/perfcounters.h
+SOURCES += main.cpp ../common/allochook.cpp
+win32: LIBS += -lpsapi
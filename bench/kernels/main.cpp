@@ -0,0 +1,198 @@
+// Throughput / allocation / peak-RSS benchmarks for the file loaders, savers
+// and text kernels from formats.h.
+//
+//   bench_kernels [--min-size 1K] [--max-size 64M] [--filter regex] [--json out.json]
+//                 [--perf-counters]
+//
+// Sizes go up in powers of 16 from --min-size to --max-size; pass
+// --max-size 1G for the full sweep (needs several GB of RAM).
+#include <QBuffer>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QRegularExpression>
+#include <QTemporaryDir>
+#include <QTextStream>
+
+#include "corpus.h"
+#include "diff.h"
+#include "docstats.h"
+#include "formats.h"
+#include "harness.h"
+
+// The pre-textcodec TXT loader, kept as the baseline for load_txt.
+static QString loadTextMode(const QString &path) {
+    QFile f(path);
+    if (!f.open(QIODevice::ReadOnly | QIODevice::Text)) return {};
+    QTextStream in(&f);
+    return in.readAll();
+}
+
+template <class Saver>
+static bool saveAs(const QString &path, const QString &text, const TextFormat &fmt) {
+    Saver s;
+    s.setFormat(fmt);
+    return s.save(path, text);
+}
+
+// text as it would be saved in another encoding.
+static QByteArray encoded(const QString &text, TextFormat fmt, Encoding e) {
+    QBuffer buf;
+    buf.open(QIODevice::WriteOnly);
+    fmt.encoding = e;
+    utf8::Writer out(&buf);
+    out.start(fmt);
+    out << text;
+    out.flush();
+    return buf.data();
+}
+
+static bool writeBytes(const QString &path, const QByteArray &bytes) {
+    QFile f(path);
+    return f.open(QIODevice::WriteOnly) && f.write(bytes) == bytes.size();
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Loader/saver/text kernel benchmarks");
+    parser.addHelpOption();
+    QCommandLineOption minSizeOpt("min-size", "Smallest input size.", "size", "1K");
+    QCommandLineOption maxSizeOpt("max-size", "Largest input size.", "size", "64M");
+    QCommandLineOption filterOpt("filter", "Only run kernels matching regex.", "regex");
+    QCommandLineOption jsonOpt("json", "Write results as JSON to file ('-' for stdout).", "file");
+    QCommandLineOption minTimeOpt("min-time", "Minimum measuring time per row, ms.", "ms", "200");
+    QCommandLineOption seedOpt("seed", "Corpus seed.", "n", "1");
+    QCommandLineOption eolOpt("crlf", "Generate CRLF inputs.");
+    QCommandLineOption perfOpt("perf-counters", "Collect cycles, instructions, cache/branch misses and page faults (Linux).");
+    parser.addOptions({minSizeOpt, maxSizeOpt, filterOpt, jsonOpt, minTimeOpt, seedOpt, eolOpt, perfOpt});
+    parser.process(app);
+
+    const qint64 minSize = corpus::parseSize(parser.value(minSizeOpt));
+    const qint64 maxSize = corpus::parseSize(parser.value(maxSizeOpt));
+    if (minSize <= 0 || maxSize < minSize) {
+        qCritical("invalid size range");
+        return 2;
+    }
+    const QRegularExpression filter(parser.isSet(filterOpt) ? parser.value(filterOpt) : QString(".*"));
+    bench::Options opt;
+    opt.minTimeMs = parser.value(minTimeOpt).toLongLong();
+    bench::PerfCounters counters;
+    if (parser.isSet(perfOpt)) {
+        if (counters.available()) opt.counters = &counters;
+        else qWarning("perf counters unavailable (check kernel.perf_event_paranoid); continuing without them");
+        for (int i = 0; i < bench::PerfCounters::EventCount; ++i) {
+            const auto e = bench::PerfCounters::Event(i);
+            if (counters.available() && !counters.available(e)) qWarning("perf counter %s unavailable", bench::PerfCounters::name(e));
+        }
+    }
+
+    QTemporaryDir dir;
+    if (!dir.isValid()) {
+        qCritical("cannot create temporary directory");
+        return 1;
+    }
+
+    QTextStream err(stderr);
+    bench::Report report;
+    auto run = [&](const QString &kernel, qint64 size, qint64 bytes, auto &&fn) {
+        if (!filter.match(kernel).hasMatch()) return;
+        bench::Result r = bench::measure(kernel, size, bytes, opt, fn);
+        bench::Report::printRow(err, r);
+        report.add(r);
+    };
+
+    for (qint64 size = minSize; size <= maxSize; size *= 16) {
+        corpus::Config cfg;
+        cfg.seed = parser.value(seedOpt).toULongLong();
+        cfg.size = size;
+        cfg.eol = parser.isSet(eolOpt) ? corpus::LineEnding::CRLF : corpus::LineEnding::LF;
+        const QByteArray textUtf8 = corpus::generate(cfg);
+        cfg.format = corpus::Format::Html;
+        const QByteArray htmlUtf8 = corpus::generate(cfg);
+        cfg.format = corpus::Format::Bin;
+        const QByteArray binBytes = corpus::generate(cfg);
+        // What the editor holds after loading; savers write the file's line endings back.
+        TextFormat fmt;
+        const QString text = textcodec::decode(textUtf8, fmt);
+        const QString raw = QString::fromUtf8(textUtf8);
+        const QByteArray cp1251Bytes = encoded(text, fmt, Encoding::Cp1251);
+        const QByteArray utf16Bytes = encoded(text, fmt, Encoding::Utf16Le);
+        TextFormat cp1251Fmt = fmt, utf16Fmt = fmt;
+        cp1251Fmt.encoding = Encoding::Cp1251;
+        utf16Fmt.encoding = Encoding::Utf16Le;
+        const QString html = QString::fromUtf8(htmlUtf8);
+
+        const QString txtPath = dir.filePath("in.txt");
+        const QString htmlPath = dir.filePath("in.html");
+        const QString binPath = dir.filePath("in.bin");
+        const QString cp1251Path = dir.filePath("in-cp1251.txt");
+        const QString utf16Path = dir.filePath("in-utf16.txt");
+        if (!writeBytes(txtPath, textUtf8) || !writeBytes(htmlPath, htmlUtf8) || !writeBytes(binPath, binBytes)
+            || !writeBytes(cp1251Path, cp1251Bytes) || !writeBytes(utf16Path, utf16Bytes)) {
+            qCritical("cannot write benchmark input");
+            return 1;
+        }
+
+        run("load_txt", size, textUtf8.size(), [&] { return qint64(TXTLoader().load(txtPath).size()); });
+        run("load_txt_qtext", size, textUtf8.size(), [&] { return qint64(loadTextMode(txtPath).size()); });
+        run("load_txt_cp1251", size, cp1251Bytes.size(), [&] { return qint64(TXTLoader().load(cp1251Path).size()); });
+        run("load_txt_utf16", size, utf16Bytes.size(), [&] { return qint64(TXTLoader().load(utf16Path).size()); });
+        run("load_html", size, htmlUtf8.size(), [&] { return qint64(HTMLLoader().load(htmlPath).size()); });
+        // First call fills the cache, the rest are hits (files under the cache's
+        // minimum size are never cached and measure the plain loader).
+        parsecache::cache().setDirectory(dir.filePath("parse-cache"));
+        run("load_html_cached", size, htmlUtf8.size(), [&] { return qint64(HTMLLoader().load(htmlPath).size()); });
+        parsecache::cache().setDirectory(QString());
+        run("load_bin", size, binBytes.size(), [&] { return qint64(BINLoader().load(binPath).size()); });
+
+        run("save_txt", size, textUtf8.size(), [&] { return qint64(saveAs<TXTSaver>(dir.filePath("out.txt"), text, fmt)); });
+        run("save_txt_cp1251", size, cp1251Bytes.size(), [&] { return qint64(saveAs<TXTSaver>(dir.filePath("out-cp1251.txt"), text, cp1251Fmt)); });
+        run("save_txt_utf16", size, utf16Bytes.size(), [&] { return qint64(saveAs<TXTSaver>(dir.filePath("out-utf16.txt"), text, utf16Fmt)); });
+        run("save_html", size, textUtf8.size(), [&] { return qint64(saveAs<HTMLSaver>(dir.filePath("out.html"), text, fmt)); });
+        run("save_bin", size, textUtf8.size(), [&] { return qint64(saveAs<BINSaver>(dir.filePath("out.bin"), text, fmt)); });
+
+        run("htmlToPlain", size, htmlUtf8.size(), [&] { return qint64(htmlToPlain(html).size()); });
+        run("countParagraphs", size, textUtf8.size(), [&] { return qint64(countParagraphs(text)); });
+        run("docstats_compute", size, textUtf8.size(), [&] { return docstats::compute(text).paragraphs(); });
+        // Validating stored statistics on open, against countParagraphs above.
+        docstats::store(txtPath, text, docstats::compute(text));
+        run("docstats_load", size, textUtf8.size(), [&] {
+            docstats::Stats st;
+            return docstats::load(txtPath, text, st) ? st.paragraphs() : qint64(-1);
+        });
+        // External change to a few paragraphs, as onFileChanged() diffs it.
+        QString edited = text;
+        for (qsizetype at = text.size() - 1; at > 0; at -= text.size() / 8 + 1) edited.insert(at, QStringLiteral("змінено"));
+        run("diff_paragraphs", size, textUtf8.size(), [&] { return qint64(diff::compute(text, edited).edits.size()); });
+        run("detectEncoding", size, qMin<qint64>(size, textcodec::detectSample), [&] {
+            return qint64(textcodec::detect(cp1251Bytes.constData(), cp1251Bytes.size()));
+        });
+        run("normalizeNewlines", size, textUtf8.size(), [&] {
+            QString copy = raw;
+            return qint64(textcodec::normalizeNewlines(copy));
+        });
+        // Newlines handled while decoding, against decoding and then normalising.
+        run("decode", size, textUtf8.size(), [&] {
+            TextFormat f;
+            return qint64(textcodec::decode(textUtf8, f).size());
+        });
+        run("decode_two_pass", size, textUtf8.size(), [&] {
+            QString t = textcodec::decodeAs(textUtf8, Encoding::Utf8);
+            return qint64(textcodec::normalizeNewlines(t)) + t.size();
+        });
+
+        if (size > maxSize / 16) break;
+    }
+
+    if (parser.isSet(jsonOpt)) {
+        const QString out = parser.value(jsonOpt);
+        if (out == "-") {
+            QTextStream(stdout) << report.toJson().toJson(QJsonDocument::Indented);
+        } else if (!report.writeJson(out)) {
+            qCritical("cannot write %s", qPrintable(out));
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,14 @@
+QT += widgets network
+CONFIG += console c++17
+CONFIG -= app_bundle
+TARGET = bench_latency
+INCLUDEPATH += ../.. ../common
+HEADERS += ../../formats.h ../../textwriter.h ../../textcodec.h ../../cpu.h ../../cancel.h ../../parsecache.h ../../durable.h ../../tracing.h ../../observer.h ../../editor.h ../../docstats.h ../../reload.h ../../diff.h ../../diffview.h ../../scheduler.h ../../edittrace.h ../../watchdog.h ../../metrics.h ../../autosave.h \
+           ../common/harness.h ../common/corpus.h ../common/perfcounters.h
+SOURCES += main.cpp ../common/allochook.cpp
+win32: LIBS += -lpsapi
+linux:packagesExist(liburing) {
+    CONFIG += link_pkgconfig
+    PKGCONFIG += liburing
+    DEFINES += OPI_HAVE_IO_URING
+}
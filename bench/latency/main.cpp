@@ -0,0 +1,277 @@
+// Keystroke latency of the real editor window, run headlessly on the
+// offscreen platform. Each edit is delivered as an input event (key press,
+// Delete, Ctrl+V) and timed until the event returns, which includes the
+// textChanged handler, paragraph counting and handing any autosave to the
+// autosave backend (all of the autosave with --autosave-backend sync).
+//
+//   bench_latency [--sizes 16K,256K,4M] [--ops 300] [--json out.json] [--autosave-backend sync]
+//   bench_latency --trace session.trace [--trace-file start.txt]
+#include <QApplication>
+#include <QClipboard>
+#include <QCommandLineParser>
+#include <QKeyEvent>
+#include <QTemporaryDir>
+#include <QTextCursor>
+
+#include "corpus.h"
+#include "editor.h"
+#include "edittrace.h"
+#include "harness.h"
+
+// ---------------- Synthetic traces ----------------
+static QString randomWord(corpus::Rng &rng) {
+    return QString::fromUtf8(rng.chance(0.5) ? rng.pick(corpus::detail::cyrillicWords)
+                                             : rng.pick(corpus::detail::asciiWords));
+}
+
+// Offset just after a random paragraph (before its blank-line separator).
+static int paragraphEnd(const QString &doc, corpus::Rng &rng) {
+    if (doc.isEmpty()) return 0;
+    int from = int(rng.next() % quint64(doc.size()));
+    int end = int(doc.indexOf("\n\n", from));
+    return end < 0 ? int(doc.size()) : end;
+}
+
+// Types words one character at a time, starting a new paragraph now and then
+// (which makes the editor autosave) and occasionally moving elsewhere.
+static EditTrace typingTrace(QString doc, int count, corpus::Rng &rng) {
+    EditTrace trace;
+    int pos = paragraphEnd(doc, rng);
+    qint64 at = 0;
+    QString pending;
+    while (trace.size() < count) {
+        if (pending.isEmpty()) {
+            if (rng.chance(0.05)) pos = paragraphEnd(doc, rng);
+            pending = (rng.chance(0.1) ? "\n\n" : " ") + randomWord(rng);
+        }
+        EditOp op;
+        op.atMs = at += rng.uniform(40, 250);
+        op.pos = pos;
+        op.text = pending.left(1);
+        pending.remove(0, 1);
+        applyEdit(doc, op);
+        ++pos;
+        trace.append(op);
+    }
+    return trace;
+}
+
+// Selects whole paragraphs (with their trailing blank line) and deletes them.
+static EditTrace deleteParagraphTrace(QString doc, int count, corpus::Rng &rng) {
+    EditTrace trace;
+    qint64 at = 0;
+    while (trace.size() < count && !doc.isEmpty()) {
+        int from = int(rng.next() % quint64(doc.size()));
+        int start = int(doc.lastIndexOf("\n\n", from));
+        start = start < 0 ? 0 : start + 2;
+        int end = int(doc.indexOf("\n\n", start));
+        end = end < 0 ? int(doc.size()) : end + 2;
+        EditOp op;
+        op.atMs = at += rng.uniform(300, 1500);
+        op.pos = start;
+        op.removed = qMax(1, end - start);
+        applyEdit(doc, op);
+        trace.append(op);
+    }
+    return trace;
+}
+
+// Pastes a few generated paragraphs at paragraph boundaries.
+static EditTrace pasteTrace(QString doc, int count, corpus::Rng &rng) {
+    EditTrace trace;
+    qint64 at = 0;
+    for (int i = 0; i < count; ++i) {
+        corpus::Config c;
+        c.seed = rng.next();
+        c.size = rng.uniform(200, 4000);
+        EditOp op;
+        op.atMs = at += rng.uniform(500, 3000);
+        op.pos = paragraphEnd(doc, rng);
+        op.text = "\n\n" + QString::fromUtf8(corpus::generate(c)).trimmed();
+        applyEdit(doc, op);
+        trace.append(op);
+    }
+    return trace;
+}
+
+// ---------------- Replay ----------------
+class CountingObserver : public IObserver {
+public:
+    int deleted = 0;
+    int saved = 0;
+    void onParagraphsDeleted(int) override { ++deleted; }
+    void onAutoSaved(const QString &) override { ++saved; }
+};
+
+static void sendKey(QWidget *w, int key, Qt::KeyboardModifiers mods, const QString &text = QString()) {
+    QKeyEvent press(QEvent::KeyPress, key, mods, text);
+    QApplication::sendEvent(w, &press);
+    QKeyEvent release(QEvent::KeyRelease, key, mods, text);
+    QApplication::sendEvent(w, &release);
+}
+
+// Untimed: select the range the edit replaces and stage clipboard contents.
+static void prepare(QTextEdit *txt, const EditOp &op) {
+    const int len = txt->document()->characterCount() - 1;
+    const int pos = qBound(0, op.pos, len);
+    QTextCursor c(txt->document());
+    c.setPosition(pos);
+    c.setPosition(qMin(len, pos + op.removed), QTextCursor::KeepAnchor);
+    txt->setTextCursor(c);
+    if (op.text.size() > 1) QApplication::clipboard()->setText(op.text);
+}
+
+// Timed: the input event a user would produce for this edit.
+static void dispatch(QTextEdit *txt, const EditOp &op) {
+    if (op.text.isEmpty()) {
+        sendKey(txt, Qt::Key_Delete, Qt::NoModifier);
+    } else if (op.text.size() == 1) {
+        const QChar c = op.text.at(0);
+        if (c == '\n') sendKey(txt, Qt::Key_Return, Qt::NoModifier, "\r");
+        else if (c == ' ') sendKey(txt, Qt::Key_Space, Qt::NoModifier, " ");
+        else sendKey(txt, c.unicode() < 128 ? int(c.toUpper().unicode()) : int(Qt::Key_unknown), Qt::NoModifier, op.text);
+    } else {
+        sendKey(txt, Qt::Key_V, Qt::ControlModifier);
+    }
+}
+
+static bench::LatencyResult replay(const QString &kernel, qint64 size, const QString &path,
+                                   const QByteArray &original, const EditTrace &trace, const QString &backend) {
+    // Autosave rewrites the file, so every run starts from the pristine copy.
+    QFile f(path);
+    if (f.open(QIODevice::WriteOnly)) f.write(original);
+    f.close();
+
+    EditorWindow w;
+    w.setAutosaveBackend(autosave::create(backend));
+    w.observers().remove(w.messageObserver()); // modal boxes would block the run
+    CountingObserver counter;
+    w.observers().add(&counter);
+    w.resize(800, 600);
+    w.show();
+    w.openFile(path);
+    w.waitForOpen();
+    QApplication::processEvents();
+
+    QTextEdit *txt = w.textEdit();
+    std::vector<qint64> samples;
+    samples.reserve(size_t(trace.size()));
+    long long allocs = 0;
+    QElapsedTimer t;
+    for (const EditOp &op : trace) {
+        prepare(txt, op);
+        QApplication::processEvents();
+        const long long a = benchAllocCount();
+        t.start();
+        dispatch(txt, op);
+        samples.push_back(t.nsecsElapsed());
+        allocs += benchAllocCount() - a;
+        QApplication::processEvents();
+    }
+    w.autosaveBackend().waitForIdle();
+    QApplication::processEvents();
+
+    bench::LatencyResult r;
+    r.kernel = kernel;
+    r.size = size;
+    r.setSamples(samples);
+    r.allocsPerEvent = samples.empty() ? 0 : allocs / qint64(samples.size());
+    r.extra["autosaves"] = counter.saved;
+    r.extra["deletions"] = counter.deleted;
+    r.extra["autosave_backend"] = QString(w.autosaveBackend().name());
+    return r;
+}
+
+int main(int argc, char *argv[]) {
+    if (!qEnvironmentVariableIsSet("QT_QPA_PLATFORM")) qputenv("QT_QPA_PLATFORM", "offscreen");
+    QApplication app(argc, argv);
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Editor keystroke latency benchmark");
+    parser.addHelpOption();
+    QCommandLineOption sizesOpt("sizes", "Comma-separated document sizes.", "list", "16K,256K,4M");
+    QCommandLineOption opsOpt("ops", "Edits per trace.", "n", "300");
+    QCommandLineOption seedOpt("seed", "Corpus and trace seed.", "n", "1");
+    QCommandLineOption jsonOpt("json", "Write results as JSON to file ('-' for stdout).", "file");
+    QCommandLineOption traceOpt("trace", "Replay a trace recorded with OPI_IDZ --record instead.", "trace");
+    QCommandLineOption traceFileOpt("trace-file", "Starting file for --trace (default: the recorded one).", "file");
+    QCommandLineOption backendOpt("autosave-backend", "auto, uring, threads or sync.", "kind", "auto");
+    parser.addOptions({sizesOpt, opsOpt, seedOpt, jsonOpt, traceOpt, traceFileOpt, backendOpt});
+    parser.process(app);
+
+    const int ops = parser.value(opsOpt).toInt();
+    const quint64 seed = parser.value(seedOpt).toULongLong();
+    QTemporaryDir dir;
+    if (!dir.isValid()) return 1;
+
+    QTextStream err(stderr);
+    bench::Report report;
+    if (parser.isSet(traceOpt)) {
+        EditTrace recorded;
+        if (!readTrace(parser.value(traceOpt), recorded)) {
+            qCritical("cannot read trace %s", qPrintable(parser.value(traceOpt)));
+            return 1;
+        }
+        // Edits of the first opened document; later opens start a new document.
+        QString start = parser.value(traceFileOpt);
+        EditTrace edits;
+        int opens = 0;
+        for (const EditOp &op : recorded) {
+            if (op.kind == EditOp::Open && ++opens == 1 && start.isEmpty()) start = op.text;
+            if (op.kind == EditOp::Edit && opens <= 1) edits.append(op);
+        }
+        QFile in(start);
+        if (!in.open(QIODevice::ReadOnly)) {
+            qCritical("cannot read starting file %s", qPrintable(start));
+            return 1;
+        }
+        const QByteArray original = in.readAll();
+        const QString path = dir.filePath(QFileInfo(start).fileName());
+        bench::LatencyResult r = replay("keystroke_recorded", original.size(), path, original, edits, parser.value(backendOpt));
+        bench::Report::printRow(err, r);
+        report.add(r);
+    }
+    const QStringList sizes = parser.isSet(traceOpt) ? QStringList() : parser.value(sizesOpt).split(',', Qt::SkipEmptyParts);
+    for (const QString &sizeStr : sizes) {
+        const qint64 size = corpus::parseSize(sizeStr);
+        if (size < 0) {
+            qCritical("invalid size %s", qPrintable(sizeStr));
+            return 2;
+        }
+        corpus::Config cfg;
+        cfg.seed = seed;
+        cfg.size = size;
+        const QByteArray original = corpus::generate(cfg);
+        const QString path = dir.filePath(QString("doc-%1.txt").arg(size));
+        QFile f(path);
+        if (!f.open(QIODevice::WriteOnly) || f.write(original) != original.size()) {
+            qCritical("cannot write %s", qPrintable(path));
+            return 1;
+        }
+        f.close();
+        // Traces are computed on the text as the editor sees it after loading.
+        const QString doc = TXTLoader().load(path);
+
+        corpus::Rng rng(seed ^ quint64(size));
+        const struct { const char *name; EditTrace trace; } runs[] = {
+            {"keystroke_typing", typingTrace(doc, ops, rng)},
+            {"keystroke_delete_para", deleteParagraphTrace(doc, qMax(1, ops / 10), rng)},
+            {"keystroke_paste", pasteTrace(doc, qMax(1, ops / 10), rng)},
+        };
+        for (const auto &run : runs) {
+            bench::LatencyResult r = replay(run.name, size, path, original, run.trace, parser.value(backendOpt));
+            bench::Report::printRow(err, r);
+            report.add(r);
+        }
+    }
+
+    if (parser.isSet(jsonOpt)) {
+        const QString out = parser.value(jsonOpt);
+        if (out == "-") {
+            QTextStream(stdout) << report.toJson().toJson(QJsonDocument::Indented);
+        } else if (!report.writeJson(out)) {
+            qCritical("cannot write %s", qPrintable(out));
+            return 1;
+        }
+    }
+    return 0;
+}
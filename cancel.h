@@ -0,0 +1,49 @@
+#pragma once
+
+#include <QtGlobal>
+#include <atomic>
+#include <memory>
+#include <utility>
+
+// ---------------- Cancellation ----------------
+// Cooperative cancellation for long-running work (loading, saving, counting).
+// The owner keeps a Source and hands its token() to the work, which polls
+// cancelled() every `pollEvery` units or so and gives up when it is set;
+// renew() cancels everything handed out so far and starts a fresh token.
+//
+// A default Token is never cancelled, so APIs can take one as an optional
+// last argument.
+namespace cancel {
+
+// Units of work (characters, lines, chunks) between polls: cheap enough to
+// vanish in the loop and still well under a millisecond of work.
+constexpr qsizetype pollEvery = 64 * 1024;
+
+class Token {
+public:
+    Token() = default;
+    bool cancelled() const { return flag && flag->load(std::memory_order_relaxed); }
+
+private:
+    friend class Source;
+    explicit Token(std::shared_ptr<const std::atomic<bool>> f) : flag(std::move(f)) {}
+    std::shared_ptr<const std::atomic<bool>> flag;
+};
+
+// Used by one owner at a time; tokens may go to any thread.
+class Source {
+public:
+    Token token() const { return Token(flag); }
+    void cancel() { flag->store(true, std::memory_order_relaxed); }
+    // Cancels the tokens handed out so far and returns a new one.
+    Token renew() {
+        cancel();
+        flag = std::make_shared<std::atomic<bool>>(false);
+        return token();
+    }
+
+private:
+    std::shared_ptr<std::atomic<bool>> flag = std::make_shared<std::atomic<bool>>(false);
+};
+
+} // namespace cancel
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <QByteArray>
+#include <QtGlobal>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OPI_CPU_SSE2 1
+#endif
+
+// AVX2 and AVX-512 kernels are compiled alongside the baseline ones and only
+// called when the CPU has them, so the binary still runs on SSE2-only
+// machines. GCC and Clang need the target attribute for the intrinsics; MSVC
+// accepts them anywhere.
+#if defined(OPI_CPU_SSE2) && (defined(_MSC_VER) || defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define OPI_CPU_X86 1
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define OPI_TARGET_AVX2
+#define OPI_TARGET_AVX512
+#else
+#define OPI_TARGET_AVX2 __attribute__((target("avx2")))
+#define OPI_TARGET_AVX512 __attribute__((target("avx2,avx512f,avx512bw")))
+#endif
+#endif
+
+// ---------------- CPU feature dispatch ----------------
+// Kernels with several implementations (textcodec.h, textwriter.h) keep a
+// table of function pointers filled once, on first use, by pick(): the best
+// implementation the CPU supports, or the one forced with OPI_CPU_LEVEL
+// (scalar, sse2, avx2 or avx512) for benchmarking and testing. A level above
+// what the CPU has is lowered with a warning.
+namespace cpu {
+
+enum class Level : quint8 {
+    Scalar,
+    Sse2,   // x86-64 baseline
+    Avx2,
+    Avx512, // AVX-512 F and BW
+};
+constexpr int levels = 4;
+
+inline const char *levelName(Level l) {
+    switch (l) {
+    case Level::Scalar: return "scalar";
+    case Level::Sse2: return "sse2";
+    case Level::Avx2: return "avx2";
+    case Level::Avx512: return "avx512";
+    }
+    return "?";
+}
+
+inline bool parseLevel(const QByteArray &name, Level *out) {
+    for (int l = 0; l < levels; ++l) {
+        if (name.trimmed().toLower() == levelName(Level(l))) {
+            *out = Level(l);
+            return true;
+        }
+    }
+    return false;
+}
+
+namespace detail {
+inline Level probe() {
+#if defined(OPI_CPU_X86) && defined(_MSC_VER) && !defined(__clang__)
+    int r[4];
+    __cpuid(r, 0);
+    const int maxLeaf = r[0];
+    __cpuid(r, 1);
+    const bool osxsave = (r[2] >> 27) & 1, avx = (r[2] >> 28) & 1;
+    if (maxLeaf < 7 || !osxsave || !avx) return Level::Sse2;
+    const quint64 xcr0 = _xgetbv(0);
+    __cpuidex(r, 7, 0);
+    const bool avx2 = (r[1] >> 5) & 1, avx512f = (r[1] >> 16) & 1, avx512bw = (r[1] >> 30) & 1;
+    if ((xcr0 & 0x6) != 0x6 || !avx2) return Level::Sse2;          // XMM and YMM state
+    if ((xcr0 & 0xE6) != 0xE6 || !avx512f || !avx512bw) return Level::Avx2; // plus opmask and ZMM
+    return Level::Avx512;
+#elif defined(OPI_CPU_X86)
+    // These also check that the OS saves the wider registers.
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) return Level::Avx512;
+    if (__builtin_cpu_supports("avx2")) return Level::Avx2;
+    return Level::Sse2;
+#elif defined(OPI_CPU_SSE2)
+    return Level::Sse2;
+#else
+    return Level::Scalar;
+#endif
+}
+
+inline Level resolve() {
+    const Level best = probe();
+    const QByteArray forced = qgetenv("OPI_CPU_LEVEL");
+    if (forced.isEmpty()) return best;
+    Level l;
+    if (!parseLevel(forced, &l)) {
+        qWarning("OPI_CPU_LEVEL: unknown level \"%s\", using %s", forced.constData(), levelName(best));
+        return best;
+    }
+    if (l > best) {
+        qWarning("OPI_CPU_LEVEL: %s is not supported by this CPU, using %s", levelName(l), levelName(best));
+        return best;
+    }
+    return l;
+}
+} // namespace detail
+
+// What the CPU supports.
+inline Level detected() {
+    static const Level l = detail::probe();
+    return l;
+}
+
+// What the kernels use: detected(), or lower if OPI_CPU_LEVEL says so.
+inline Level level() {
+    static const Level l = detail::resolve();
+    return l;
+}
+
+// The implementation for level(): the highest of impl[0..levels) at or below
+// it that exists (non-null). impl[Scalar] must always exist.
+template <class Fn>
+inline Fn pick(const Fn (&impl)[levels]) {
+    for (int l = int(level()); l > 0; --l)
+        if (impl[l]) return impl[l];
+    return impl[0];
+}
+
+} // namespace cpu
@@ -0,0 +1,317 @@
+#pragma once
+
+#include <QString>
+#include <QStringList>
+#include <QStringView>
+#include <QtGlobal>
+#include <algorithm>
+#include <vector>
+
+#include "parsecache.h"
+#include "scheduler.h"
+#include "textcodec.h"
+#include "tracing.h"
+
+// ---------------- Paragraph diff ----------------
+// Compares two versions of a document paragraph by paragraph: both sides are
+// cut into paragraphs (each with the blank lines that follow it) and hashed,
+// the hash sequences are aligned patience-style (unique paragraphs as
+// anchors, a bounded Myers pass between them), and only paragraphs that did
+// change are compared character by character. Hashing and the gaps between
+// top-level anchors run in parallel, so 100 MB documents diff in about the
+// time it takes to read them.
+namespace diff {
+
+// A run of paragraphs that differs: [aFirst, aFirst + aCount) of the old
+// side became [bFirst, bFirst + bCount) of the new one.
+struct Hunk {
+    qsizetype aFirst = 0, aCount = 0;
+    qsizetype bFirst = 0, bCount = 0;
+};
+
+// Replace old[aPos, aPos + aLen) with new[bPos, bPos + bLen).
+struct Edit {
+    qsizetype aPos = 0, aLen = 0;
+    qsizetype bPos = 0, bLen = 0;
+};
+
+struct Paragraph {
+    qsizetype start = 0, length = 0;
+    quint64 hash = 0;
+};
+
+struct Result {
+    std::vector<Paragraph> a, b;
+    std::vector<Hunk> hunks;
+    std::vector<Edit> edits; // ascending, non-overlapping
+    bool identical() const { return hunks.empty(); }
+};
+
+namespace detail {
+// Runs fn(begin, end) over [0, n) in up to one slice per scheduler worker.
+template <class Fn>
+void parallelFor(qsizetype n, qsizetype minSlice, Fn fn) {
+    const qsizetype slices = qBound<qsizetype>(1, n / qMax<qsizetype>(1, minSlice), sched::scheduler().workerCount());
+    if (slices <= 1) {
+        fn(qsizetype(0), n);
+        return;
+    }
+    sched::TaskGroup group;
+    for (qsizetype s = 1; s < slices; ++s)
+        sched::scheduler().submit(sched::Priority::Interactive, [&, s]() { fn(n * s / slices, n * (s + 1) / slices); }, &group);
+    fn(0, n / slices);
+    group.wait();
+}
+
+// Paragraphs with the blank lines after them, so they tile the text exactly.
+inline std::vector<Paragraph> split(const QString &text) {
+    std::vector<Paragraph> out;
+    const char16_t *p = text.utf16();
+    const qsizetype n = text.size();
+    qsizetype start = 0, i = 0;
+    while (i < n) {
+        const qsizetype lf = textcodec::detail::findUnit(p, i, n, u'\n');
+        if (lf + 1 >= n) break;
+        i = lf + 1;
+        if (p[i] != '\n') continue;
+        while (i < n && p[i] == '\n') ++i;
+        out.push_back({start, i - start, 0});
+        start = i;
+    }
+    if (start < n) out.push_back({start, n - start, 0});
+    return out;
+}
+
+inline void hashAll(const QString &text, std::vector<Paragraph> &paras) {
+    const char *base = reinterpret_cast<const char *>(text.utf16());
+    parallelFor(qsizetype(paras.size()), 256, [&](qsizetype from, qsizetype to) {
+        for (qsizetype k = from; k < to; ++k) {
+            Paragraph &q = paras[size_t(k)];
+            q.hash = parsecache::contentHash(base + q.start * 2, q.length * 2);
+        }
+    });
+}
+
+struct Match {
+    qsizetype a, b;
+};
+
+// Gaps whose edit distance exceeds this are reported as one replacement.
+constexpr qsizetype maxMyersCost = 2048;
+
+// Myers' O(ND) alignment of a[a0, a1) and b[b0, b1); false if it would
+// cost more than maxMyersCost.
+inline bool myers(const std::vector<quint64> &a, qsizetype a0, qsizetype a1, const std::vector<quint64> &b, qsizetype b0,
+                  qsizetype b1, std::vector<Match> &out) {
+    const qsizetype n = a1 - a0, m = b1 - b0, maxD = qMin(n + m, maxMyersCost);
+    const qsizetype off = maxD + 1;
+    std::vector<qsizetype> v(size_t(2 * off + 1), 0);
+    std::vector<std::vector<qsizetype>> trace;
+    for (qsizetype d = 0; d <= maxD; ++d) {
+        trace.emplace_back(v.begin() + (off - d), v.begin() + (off + d + 1)); // diagonals -d..d
+        for (qsizetype k = -d; k <= d; k += 2) {
+            qsizetype x = k == -d || (k != d && v[size_t(off + k - 1)] < v[size_t(off + k + 1)]) ? v[size_t(off + k + 1)]
+                                                                                            : v[size_t(off + k - 1)] + 1;
+            qsizetype y = x - k;
+            while (x < n && y < m && a[size_t(a0 + x)] == b[size_t(b0 + y)]) ++x, ++y;
+            v[size_t(off + k)] = x;
+            if (x >= n && y >= m) {
+                // Walk the trace back, collecting the diagonal moves.
+                std::vector<Match> rev;
+                for (qsizetype dd = d; dd > 0; --dd) {
+                    const std::vector<qsizetype> &pv = trace[size_t(dd)];
+                    const qsizetype kk = x - y;
+                    const bool down = kk == -dd || (kk != dd && pv[size_t(dd + kk - 1)] < pv[size_t(dd + kk + 1)]);
+                    const qsizetype pk = down ? kk + 1 : kk - 1;
+                    const qsizetype px = pv[size_t(dd + pk)], py = px - pk;
+                    const qsizetype sx = down ? px : px + 1;
+                    while (x > sx && y > sx - kk) rev.push_back({a0 + --x, b0 + --y});
+                    x = px;
+                    y = py;
+                }
+                while (x > 0 && y > 0) rev.push_back({a0 + --x, b0 + --y});
+                out.insert(out.end(), rev.rbegin(), rev.rend());
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Paragraphs occurring exactly once on each side of a[a0, a1) and
+// b[b0, b1), reduced to the longest run increasing on both (patience sort).
+inline std::vector<Match> uniqueAnchors(const std::vector<quint64> &a, qsizetype a0, qsizetype a1, const std::vector<quint64> &b,
+                                        qsizetype b0, qsizetype b1) {
+    // Open-addressed table: the keys are already well mixed hashes.
+    struct Slot {
+        quint64 key;
+        qsizetype a, b; // position, -1 if absent, -2 if repeated
+        bool used;
+    };
+    size_t cap = 16;
+    while (cap < size_t(2 * (a1 - a0 + b1 - b0))) cap <<= 1;
+    std::vector<Slot> table(cap, Slot{0, -1, -1, false});
+    auto slot = [&](quint64 key) -> Slot & {
+        size_t i = size_t(key ^ (key >> 31)) & (cap - 1);
+        while (table[i].used && table[i].key != key) i = (i + 1) & (cap - 1);
+        Slot &s = table[i];
+        if (!s.used) s = Slot{key, -1, -1, true};
+        return s;
+    };
+    for (qsizetype i = a0; i < a1; ++i) {
+        Slot &s = slot(a[size_t(i)]);
+        s.a = s.a == -1 ? i : -2;
+    }
+    for (qsizetype j = b0; j < b1; ++j) {
+        Slot &s = slot(b[size_t(j)]);
+        s.b = s.b == -1 ? j : -2;
+    }
+    std::vector<Match> unique;
+    for (qsizetype i = a0; i < a1; ++i) {
+        const Slot &s = slot(a[size_t(i)]);
+        if (s.a >= 0 && s.b >= 0) unique.push_back({i, s.b});
+    }
+    std::vector<qsizetype> piles, prev(unique.size(), -1), top;
+    for (qsizetype k = 0; k < qsizetype(unique.size()); ++k) {
+        // Anchors mostly come in order, so try the last pile first.
+        const auto pos = piles.empty() || unique[size_t(k)].b > piles.back() ? piles.end()
+                                                                              : std::lower_bound(piles.begin(), piles.end(), unique[size_t(k)].b);
+        const qsizetype pile = pos - piles.begin();
+        if (pos == piles.end()) {
+            piles.push_back(unique[size_t(k)].b);
+            top.push_back(k);
+        } else {
+            *pos = unique[size_t(k)].b;
+            top[size_t(pile)] = k;
+        }
+        prev[size_t(k)] = pile > 0 ? top[size_t(pile - 1)] : -1;
+    }
+    std::vector<Match> anchors;
+    for (qsizetype k = top.empty() ? -1 : top.back(); k >= 0; k = prev[size_t(k)]) anchors.push_back(unique[size_t(k)]);
+    std::reverse(anchors.begin(), anchors.end());
+    return anchors;
+}
+
+// Patience alignment of a[a0, a1) and b[b0, b1), appending matches in order.
+inline void align(const std::vector<quint64> &a, qsizetype a0, qsizetype a1, const std::vector<quint64> &b, qsizetype b0,
+                  qsizetype b1, std::vector<Match> &out) {
+    while (a0 < a1 && b0 < b1 && a[size_t(a0)] == b[size_t(b0)]) out.push_back({a0++, b0++});
+    std::vector<Match> tail;
+    while (a0 < a1 && b0 < b1 && a[size_t(a1 - 1)] == b[size_t(b1 - 1)]) tail.push_back({--a1, --b1});
+    if (a0 < a1 && b0 < b1) {
+        const std::vector<Match> anchors = uniqueAnchors(a, a0, a1, b, b0, b1);
+        if (anchors.empty()) {
+            std::vector<Match> found;
+            if (myers(a, a0, a1, b, b0, b1, found)) out.insert(out.end(), found.begin(), found.end());
+        } else {
+            qsizetype pa = a0, pb = b0;
+            for (const Match &m : anchors) {
+                align(a, pa, m.a, b, pb, m.b, out);
+                out.push_back(m);
+                pa = m.a + 1;
+                pb = m.b + 1;
+            }
+            align(a, pa, a1, b, pb, b1, out);
+        }
+    }
+    out.insert(out.end(), tail.rbegin(), tail.rend());
+}
+
+inline std::vector<quint64> hashes(const std::vector<Paragraph> &paras) {
+    std::vector<quint64> h(paras.size());
+    for (size_t k = 0; k < paras.size(); ++k) h[k] = paras[k].hash;
+    return h;
+}
+
+// Character-level edit turning a[aPos, aPos + aLen) into b[bPos, bPos + bLen),
+// trimmed to the part that actually differs.
+inline Edit refine(QStringView a, QStringView b, Edit e) {
+    qsizetype pre = 0;
+    const qsizetype limit = qMin(e.aLen, e.bLen);
+    while (pre < limit && a[e.aPos + pre] == b[e.bPos + pre]) ++pre;
+    qsizetype suf = 0;
+    while (suf < limit - pre && a[e.aPos + e.aLen - 1 - suf] == b[e.bPos + e.bLen - 1 - suf]) ++suf;
+    return {e.aPos + pre, e.aLen - pre - suf, e.bPos + pre, e.bLen - pre - suf};
+}
+} // namespace detail
+
+inline Result compute(const QString &a, const QString &b) {
+    OPI_TRACE_SCOPE("diff::compute");
+    Result r;
+    r.a = detail::split(a);
+    r.b = detail::split(b);
+    detail::hashAll(a, r.a);
+    detail::hashAll(b, r.b);
+    const std::vector<quint64> ha = detail::hashes(r.a), hb = detail::hashes(r.b);
+    const qsizetype na = qsizetype(ha.size()), nb = qsizetype(hb.size());
+
+    // Top-level anchors first; the gaps between them are independent.
+    std::vector<detail::Match> anchors = detail::uniqueAnchors(ha, 0, na, hb, 0, nb);
+    anchors.push_back({na, nb}); // sentinel
+
+    std::vector<std::vector<detail::Match>> gaps(anchors.size());
+    detail::parallelFor(qsizetype(anchors.size()), 64, [&](qsizetype from, qsizetype to) {
+        for (qsizetype g = from; g < to; ++g) {
+            const detail::Match lo = g > 0 ? detail::Match{anchors[size_t(g - 1)].a + 1, anchors[size_t(g - 1)].b + 1} : detail::Match{0, 0};
+            detail::align(ha, lo.a, anchors[size_t(g)].a, hb, lo.b, anchors[size_t(g)].b, gaps[size_t(g)]);
+        }
+    });
+
+    // Matches to hunks; a hash match whose text differs counts as a change.
+    const QStringView va(a), vb(b);
+    qsizetype pa = 0, pb = 0;
+    auto flush = [&](qsizetype ea, qsizetype eb) {
+        if (ea > pa || eb > pb) r.hunks.push_back({pa, ea - pa, pb, eb - pb});
+    };
+    for (size_t g = 0; g < anchors.size(); ++g) {
+        std::vector<detail::Match> &ms = gaps[g];
+        if (g + 1 < anchors.size()) ms.push_back(anchors[g]);
+        for (const detail::Match &m : ms) {
+            const Paragraph &x = r.a[size_t(m.a)], &y = r.b[size_t(m.b)];
+            if (x.length == y.length && va.mid(x.start, x.length) == vb.mid(y.start, y.length)) {
+                flush(m.a, m.b);
+                pa = m.a + 1;
+                pb = m.b + 1;
+            }
+        }
+    }
+    flush(na, nb);
+
+    // Only the changed paragraphs are compared character by character.
+    for (const Hunk &h : r.hunks) {
+        auto range = [](const std::vector<Paragraph> &ps, qsizetype first, qsizetype count, qsizetype textSize) {
+            const qsizetype begin = first < qsizetype(ps.size()) ? ps[size_t(first)].start : textSize;
+            const qsizetype end = count ? ps[size_t(first + count - 1)].start + ps[size_t(first + count - 1)].length : begin;
+            return std::pair<qsizetype, qsizetype>(begin, end - begin);
+        };
+        if (h.aCount == h.bCount) {
+            for (qsizetype k = 0; k < h.aCount; ++k) {
+                const Paragraph &x = r.a[size_t(h.aFirst + k)], &y = r.b[size_t(h.bFirst + k)];
+                const Edit e = detail::refine(va, vb, {x.start, x.length, y.start, y.length});
+                if (e.aLen || e.bLen) r.edits.push_back(e);
+            }
+        } else {
+            const auto ra = range(r.a, h.aFirst, h.aCount, a.size()), rb = range(r.b, h.bFirst, h.bCount, b.size());
+            const Edit e = detail::refine(va, vb, {ra.first, ra.second, rb.first, rb.second});
+            if (e.aLen || e.bLen) r.edits.push_back(e);
+        }
+    }
+    return r;
+}
+
+// Unified-style listing of the hunks, paragraph by paragraph.
+inline QString render(const QString &a, const QString &b, const Result &r) {
+    QString out;
+    auto list = [&out](const QString &text, const Paragraph &p, QChar sign) {
+        const QStringList lines = text.mid(p.start, p.length).trimmed().split('\n');
+        for (const QString &line : lines) out += sign + QString(' ') + line + '\n';
+    };
+    for (const Hunk &h : r.hunks) {
+        out += QString("@@ -%1,%2 +%3,%4 @@\n").arg(h.aFirst + 1).arg(h.aCount).arg(h.bFirst + 1).arg(h.bCount);
+        for (qsizetype k = 0; k < h.aCount; ++k) list(a, r.a[size_t(h.aFirst + k)], '-');
+        for (qsizetype k = 0; k < h.bCount; ++k) list(b, r.b[size_t(h.bFirst + k)], '+');
+    }
+    return out;
+}
+
+} // namespace diff
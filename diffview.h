@@ -0,0 +1,35 @@
+#pragma once
+
+#include <QPlainTextEdit>
+#include <QString>
+#include <QVBoxLayout>
+#include <QWidget>
+
+#include "diff.h"
+
+// ---------------- Diff view ----------------
+namespace diff {
+
+// Read-only window with render()'s output.
+class DiffView : public QWidget {
+public:
+    explicit DiffView(QWidget *parent = nullptr) : QWidget(parent, Qt::Window) {
+        setWindowTitle("Відмінності від файлу на диску");
+        resize(720, 540);
+        QVBoxLayout *layout = new QVBoxLayout(this);
+        view->setReadOnly(true);
+        view->setLineWrapMode(QPlainTextEdit::NoWrap);
+        layout->addWidget(view);
+    }
+
+    void showDiff(const QString &a, const QString &b, const Result &r) {
+        view->setPlainText(r.identical() ? QString("Відмінностей немає.") : render(a, b, r));
+        QWidget::show();
+        raise();
+    }
+
+private:
+    QPlainTextEdit *view = new QPlainTextEdit;
+};
+
+} // namespace diff
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <QByteArray>
+#include <QFile>
+#include <QFileInfo>
+#include <QString>
+#include <QtGlobal>
+#include <cstring>
+#include <vector>
+
+#include "cancel.h"
+#include "durable.h"
+#include "parsecache.h"
+#include "tracing.h"
+
+#if defined(Q_OS_LINUX)
+#include <cerrno>
+#include <sys/xattr.h>
+#endif
+
+// ---------------- Document statistics ----------------
+// Counts gathered when a document is saved and stored next to it: in the
+// user.opi.stats extended attribute on Linux, or in a hidden sidecar file
+// (.name.opistats) where xattrs are unavailable or too small. On open they
+// are used only if the file's size and mtime and a hash of the loaded text
+// still match, which is far cheaper than counting again.
+namespace docstats {
+
+struct Stats {
+    qint64 chars = 0;
+    qint64 words = 0;
+    std::vector<qint64> paragraphStarts; // as paragraphStarts() in formats.h
+    qint64 paragraphs() const { return qint64(paragraphStarts.size()); }
+};
+
+inline quint64 textHash(const QString &text) {
+    return parsecache::contentHash(reinterpret_cast<const char *>(text.utf16()), text.size() * qsizetype(sizeof(char16_t)));
+}
+
+// One pass over text. Words are runs of non-space characters; paragraphs are
+// runs of lines that are not blank, like countParagraphs(). Stops part way
+// if the token is cancelled.
+inline Stats compute(const QString &text, const cancel::Token &cancelToken = {}) {
+    OPI_TRACE_SCOPE("docstats::compute");
+    Stats s;
+    s.chars = text.size();
+    const QChar *p = text.constData();
+    const qsizetype n = text.size();
+    bool inWord = false, inParagraph = false, lineBlank = true;
+    qsizetype lineStart = 0;
+    for (qsizetype i = 0; i <= n; ++i) {
+        if (i % cancel::pollEvery == 0 && cancelToken.cancelled()) break;
+        if (i == n || p[i] == '\n') {
+            if (!lineBlank && !inParagraph) s.paragraphStarts.push_back(lineStart);
+            inParagraph = !lineBlank;
+            lineBlank = true;
+            lineStart = i + 1;
+            inWord = false;
+            continue;
+        }
+        if (p[i].isSpace()) {
+            inWord = false;
+        } else {
+            lineBlank = false;
+            if (!inWord) ++s.words;
+            inWord = true;
+        }
+    }
+    return s;
+}
+
+namespace detail {
+constexpr char magic[8] = {'O', 'P', 'I', 'S', 'T', '0', '0', '1'};
+constexpr const char *xattrName = "user.opi.stats";
+
+struct Header {
+    char magic[8];
+    quint64 fileSize;
+    qint64 fileMtimeMs;
+    quint64 textHash;
+    qint64 chars;
+    qint64 words;
+    quint64 paragraphs; // followed by this many qint64 offsets
+};
+
+inline QString sidecarPath(const QString &path) {
+    const QFileInfo fi(path);
+    return fi.absolutePath() + "/." + fi.fileName() + ".opistats";
+}
+
+inline QByteArray serialize(const QString &path, const Stats &s, quint64 hash) {
+    const QFileInfo fi(path);
+    Header h;
+    std::memcpy(h.magic, magic, sizeof(magic));
+    h.fileSize = quint64(fi.size());
+    h.fileMtimeMs = fi.lastModified().toMSecsSinceEpoch();
+    h.textHash = hash;
+    h.chars = s.chars;
+    h.words = s.words;
+    h.paragraphs = quint64(s.paragraphStarts.size());
+    QByteArray out(qsizetype(sizeof(h) + s.paragraphStarts.size() * sizeof(qint64)), Qt::Uninitialized);
+    std::memcpy(out.data(), &h, sizeof(h));
+    std::memcpy(out.data() + sizeof(h), s.paragraphStarts.data(), s.paragraphStarts.size() * sizeof(qint64));
+    return out;
+}
+
+inline bool parse(const QByteArray &data, const QString &path, const QString &text, Stats &out) {
+    Header h;
+    if (data.size() < qsizetype(sizeof(h))) return false;
+    std::memcpy(&h, data.constData(), sizeof(h));
+    const QFileInfo fi(path);
+    if (std::memcmp(h.magic, magic, sizeof(magic)) != 0 || h.fileSize != quint64(fi.size())
+        || h.fileMtimeMs != fi.lastModified().toMSecsSinceEpoch() || h.chars != text.size()
+        || h.paragraphs > quint64(text.size()) + 1
+        || quint64(data.size()) != sizeof(h) + h.paragraphs * sizeof(qint64) || h.textHash != textHash(text))
+        return false;
+    out.chars = h.chars;
+    out.words = h.words;
+    out.paragraphStarts.resize(size_t(h.paragraphs));
+    std::memcpy(out.paragraphStarts.data(), data.constData() + sizeof(h), size_t(h.paragraphs * sizeof(qint64)));
+    return true;
+}
+} // namespace detail
+
+// Records s (computed from text) for the file at path as it is now on disk.
+inline bool store(const QString &path, const QString &text, const Stats &s) {
+    OPI_TRACE_SCOPE("docstats::store");
+    const QByteArray data = detail::serialize(path, s, textHash(text));
+#if defined(Q_OS_LINUX)
+    if (::setxattr(QFile::encodeName(path).constData(), detail::xattrName, data.constData(), size_t(data.size()), 0) == 0) {
+        QFile::remove(detail::sidecarPath(path)); // superseded
+        return true;
+    }
+    if (errno != E2BIG && errno != ENOSPC && errno != ENOTSUP && errno != ERANGE) return false;
+#endif
+    durable::AtomicFile f(detail::sidecarPath(path));
+    return f.open() && f.device()->write(data) == data.size() && f.commit();
+}
+
+// Fills out if valid statistics for text, as loaded from path, were stored.
+inline bool load(const QString &path, const QString &text, Stats &out) {
+    OPI_TRACE_SCOPE("docstats::load");
+#if defined(Q_OS_LINUX)
+    const QByteArray name = QFile::encodeName(path);
+    const ssize_t len = ::getxattr(name.constData(), detail::xattrName, nullptr, 0);
+    if (len > 0) {
+        QByteArray data(qsizetype(len), Qt::Uninitialized);
+        if (::getxattr(name.constData(), detail::xattrName, data.data(), size_t(len)) == len)
+            return detail::parse(data, path, text, out);
+    }
+#endif
+    QFile f(detail::sidecarPath(path));
+    return f.open(QIODevice::ReadOnly) && detail::parse(f.readAll(), path, text, out);
+}
+
+} // namespace docstats
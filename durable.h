@@ -0,0 +1,287 @@
+#pragma once
+
+#include <QByteArray>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QString>
+#include <QTemporaryFile>
+#include <QtGlobal>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "tracing.h"
+
+#if defined(Q_OS_WIN)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdio>
+#endif
+
+// ---------------- Atomic, durable saves ----------------
+// Every save writes a temporary file next to the target and renames it over
+// the target, so a process crash leaves either the old or the new file, never
+// a torn one. Surviving a power loss as well needs the data on disk before the
+// rename; how much is forced to disk is a global choice:
+//
+//   none   never sync: old-or-new only against process crashes
+//   save   explicit saves sync the temporary before the rename and the
+//          directory after it (default); autosaves as with none
+//   group  explicit saves as with save; autosaves landing within a short
+//          window share one sync (syncfs per filesystem on Linux) before
+//          their renames, and another for the renames themselves
+namespace durable {
+
+enum class Mode { None, Save, Group };
+
+// What a save is for; see Mode.
+enum class Kind { Explicit, Autosave };
+
+inline Mode &modeRef() {
+    static Mode m = Mode::Save;
+    return m;
+}
+inline Mode mode() { return modeRef(); }
+inline void setMode(Mode m) { modeRef() = m; }
+
+// "none", "save" or "group"; false for anything else.
+inline bool parseMode(const QString &s, Mode &out) {
+    if (s == "none") out = Mode::None;
+    else if (s == "save") out = Mode::Save;
+    else if (s == "group") out = Mode::Group;
+    else return false;
+    return true;
+}
+
+// fsync of an open file's data.
+inline bool syncHandle(int fd) {
+#if defined(Q_OS_WIN)
+    return FlushFileBuffers(reinterpret_cast<HANDLE>(_get_osfhandle(fd)));
+#else
+    return ::fsync(fd) == 0;
+#endif
+}
+
+// fsync of the directory holding path, so a rename in it is on disk. Windows
+// has no directory handle to flush; the rename is journalled by NTFS.
+inline bool syncDirectory(const QString &path) {
+#if defined(Q_OS_WIN)
+    Q_UNUSED(path);
+    return true;
+#else
+    const int fd = ::open(QFile::encodeName(QFileInfo(path).absolutePath()).constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return false;
+    const bool ok = ::fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+#endif
+}
+
+// fsync of the file and, on Unix, of its directory entry.
+inline bool syncFile(const QString &path) {
+    OPI_TRACE_SCOPE("durable::syncFile");
+#if defined(Q_OS_WIN)
+    QFile f(path);
+    if (!f.open(QIODevice::ReadWrite)) return false;
+    return FlushFileBuffers(reinterpret_cast<HANDLE>(_get_osfhandle(f.handle())));
+#else
+    const int fd = ::open(QFile::encodeName(path).constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    const bool ok = syncHandle(fd);
+    ::close(fd);
+    return ok && syncDirectory(path);
+#endif
+}
+
+// Collects autosaved paths and syncs them together once the window since the
+// first one has passed. add() returns at once; syncNow() waits for the batch
+// it joined, which AtomicFile uses to get an autosave's data on disk before
+// its rename.
+class GroupCommit {
+public:
+    static GroupCommit &instance() {
+        static GroupCommit g;
+        return g;
+    }
+
+    void setWindowMs(int ms) { windowMs = qMax(1, ms); }
+
+    void add(const QString &path) {
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            enqueue(path);
+        }
+        cv.notify_all();
+    }
+
+    // Adds path and blocks until its batch has been synced.
+    void syncNow(const QString &path) {
+        std::unique_lock<std::mutex> lock(mu);
+        const quint64 batch = enqueue(path);
+        cv.notify_all();
+        synced.wait(lock, [&]() { return completed >= batch || stopping; });
+    }
+
+    // Syncs everything pending now (used at exit).
+    void flush() {
+        std::vector<QString> batch;
+        quint64 seq;
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            batch.swap(pending);
+            seq = ++started;
+        }
+        syncBatch(batch);
+        finished(seq);
+    }
+
+    ~GroupCommit() {
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            stopping = true;
+        }
+        cv.notify_all();
+        synced.notify_all();
+        if (worker.joinable()) worker.join();
+        flush();
+    }
+
+private:
+    std::mutex mu;
+    std::condition_variable cv, synced;
+    std::thread worker;
+    std::vector<QString> pending;
+    std::chrono::steady_clock::time_point deadline;
+    int windowMs = 100;
+    bool stopping = false;
+    quint64 started = 0, completed = 0; // batches taken / synced
+
+    GroupCommit() = default;
+
+    // Under mu. Returns the number of the batch path joins.
+    quint64 enqueue(const QString &path) {
+        if (!worker.joinable()) worker = std::thread([this]() { run(); });
+        if (pending.empty()) deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(windowMs);
+        pending.push_back(path);
+        return started + 1;
+    }
+
+    void finished(quint64 seq) {
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            completed = qMax(completed, seq);
+        }
+        synced.notify_all();
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mu);
+        while (!stopping) {
+            if (pending.empty()) {
+                cv.wait(lock);
+                continue;
+            }
+            if (cv.wait_until(lock, deadline, [this]() { return stopping; })) break;
+            std::vector<QString> batch;
+            batch.swap(pending);
+            const quint64 seq = ++started;
+            lock.unlock();
+            syncBatch(batch);
+            finished(seq);
+            lock.lock();
+        }
+    }
+
+    static void syncBatch(const std::vector<QString> &batch) {
+        if (batch.empty()) return;
+        OPI_TRACE_SCOPE("durable::groupCommit");
+#if defined(Q_OS_LINUX)
+        // One syncfs per filesystem covers every file and rename in the batch.
+        std::vector<dev_t> done;
+        for (const QString &p : batch) {
+            const int fd = ::open(QFile::encodeName(p).constData(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) continue;
+            struct stat st;
+            if (::fstat(fd, &st) == 0 && std::find(done.begin(), done.end(), st.st_dev) == done.end()) {
+                ::syncfs(fd);
+                done.push_back(st.st_dev);
+            }
+            ::close(fd);
+        }
+#else
+        std::vector<QString> unique = batch;
+        std::sort(unique.begin(), unique.end());
+        unique.erase(std::unique(unique.begin(), unique.end()), unique.end());
+        for (const QString &p : unique) syncFile(p);
+#endif
+    }
+};
+
+// Temporary sibling of `path` that replaces it on commit(). If path is a
+// symlink the link target is replaced; its permissions are kept.
+class AtomicFile {
+public:
+    explicit AtomicFile(const QString &path, Kind kind = Kind::Explicit) : kind(kind) {
+        const QFileInfo fi(path);
+        target = fi.isSymLink() ? fi.symLinkTarget() : fi.absoluteFilePath();
+        tmp.setFileTemplate(QFileInfo(target).absolutePath() + "/." + QFileInfo(target).fileName() + ".XXXXXX");
+    }
+
+    // Binary: line endings are the saver's job (utf8::Writer::start).
+    bool open() { return tmp.open(); }
+
+    QIODevice *device() { return &tmp; }
+    int handle() const { return tmp.handle(); }
+
+    // Moves the finished temporary over the target, first getting its data
+    // to disk as mode() asks, so the target is never renamed to a file whose
+    // contents a power loss could still take away.
+    bool commit() {
+        if (!tmp.flush()) return false;
+        const bool explicitSync = kind == Kind::Explicit && mode() != Mode::None;
+        if (explicitSync) {
+            OPI_TRACE_SCOPE("durable::syncFile");
+            if (!syncHandle(tmp.handle())) return false;
+        } else if (kind == Kind::Autosave && mode() == Mode::Group) {
+            GroupCommit::instance().syncNow(tmp.fileName());
+        }
+        const QFileDevice::Permissions perms = QFile::exists(target)
+            ? QFile::permissions(target)
+            : QFileDevice::ReadOwner | QFileDevice::WriteOwner | QFileDevice::ReadUser | QFileDevice::WriteUser
+                  | QFileDevice::ReadGroup | QFileDevice::ReadOther;
+        tmp.setPermissions(perms);
+        const QString from = tmp.fileName();
+        tmp.close();
+#if defined(Q_OS_WIN)
+        const bool ok = MoveFileExW(reinterpret_cast<const wchar_t *>(QDir::toNativeSeparators(from).utf16()),
+                                    reinterpret_cast<const wchar_t *>(QDir::toNativeSeparators(target).utf16()),
+                                    MOVEFILE_REPLACE_EXISTING | (explicitSync ? MOVEFILE_WRITE_THROUGH : 0));
+#else
+        const bool ok = std::rename(QFile::encodeName(from).constData(), QFile::encodeName(target).constData()) == 0;
+#endif
+        if (!ok) return false;
+        tmp.setAutoRemove(false);
+        // The new file is in place either way; these only make the rename durable.
+        if (explicitSync) syncDirectory(target);
+        else if (kind == Kind::Autosave && mode() == Mode::Group) GroupCommit::instance().add(target);
+        return true;
+    }
+
+private:
+    Kind kind;
+    QString target;
+    QTemporaryFile tmp; // removed unless committed
+};
+
+} // namespace durable
@@ -0,0 +1,557 @@
+#pragma once
+
+#include <QAction>
+#include <QApplication>
+#include <QElapsedTimer>
+#include <QFileDialog>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
+#include <QKeyEvent>
+#include <QKeySequence>
+#include <QMenu>
+#include <QMenuBar>
+#include <QMessageBox>
+#include <QString>
+#include <QTextBlock>
+#include <QTextEdit>
+#include <QTimer>
+#include <QVBoxLayout>
+#include <QWidget>
+#include <memory>
+#include <mutex>
+#include <optional>
+
+#include "autosave.h"
+#include "diffview.h"
+#include "docstats.h"
+#include "edittrace.h"
+#include "formats.h"
+#include "metrics.h"
+#include "observer.h"
+#include "reload.h"
+#include "scheduler.h"
+#include "tracing.h"
+#include "watchdog.h"
+
+// Call count and wall time of one code path, for replay profiling.
+struct TimingStat {
+    qint64 count = 0;
+    qint64 totalNs = 0;
+    qint64 maxNs = 0;
+    void add(qint64 ns) { ++count; totalNs += ns; maxNs = qMax(maxNs, ns); }
+};
+
+struct EditorProfile {
+    TimingStat handler;    // whole textChanged handler
+    TimingStat counting;   // countParagraphs
+    TimingStat autosave;   // autosave submit to completion (off the GUI thread unless sync)
+    TimingStat notify;     // Subject::notify*
+};
+
+// ---------------- Editor window ----------------
+// The whole application UI. Kept free of dialogs outside the menu handlers so
+// the benchmarks can drive it headlessly through openFile() and the text edit.
+class EditorWindow : public QWidget {
+    QTextEdit *txt = nullptr;
+
+    // State
+    QString currentPath;
+    std::unique_ptr<IFileFactory> currentFactory; // factory for current file extension
+    std::optional<TextFormat> currentFormat;      // found on load, kept on save; else the saver's default
+    int lastParagraphCount = 0;
+
+    // Subject / observer
+    Subject subject;
+    MessageObserver msgObs{this};
+
+    std::unique_ptr<autosave::Backend> autosaver = autosave::create();
+    QTimer autosaveTimer; // deferred autosave while the backend is behind
+    SessionRecorder *recorder = nullptr;
+    EditorProfile prof;
+    metrics::MetricsPanel *metricsPanel = nullptr;
+    diff::DiffView *diffView = nullptr;
+    sched::TaskGroup docTasks; // background work for this document
+    cancel::Source statsCancel; // renewed by each open and save
+    cancel::Source openCancel;  // renewed by each open
+    cancel::Source reloadCancel; // renewed by each reload of an external change, cancelled by open
+    bool opening = false;       // an openFile() has not shown its document yet
+
+    // External changes to currentPath (see reload.h)
+    QFileSystemWatcher watcher;
+    QTimer reloadTimer;               // coalesces bursts of change notifications
+    std::mutex diskMu;                // disk is also updated from autosave threads
+    struct { QString path; reload::DiskStamp stamp; } disk;
+    int syncedRevision = 0;           // document revision that matches the file
+    int autosavesInFlight = 0;        // submitted, onAutosaved() not run yet
+    bool recheckDisk = false;         // a change notification waits for them
+
+    int transactions = 0;             // open Transaction scopes
+
+public:
+    // Scope for bulk programmatic changes to the document (open, reload, bulk
+    // transforms). While one is open, textChanged does no paragraph tracking,
+    // autosave or notification, the session recorder is paused and, unless
+    // undo is kept, nothing goes on the undo stack. commit() (or the
+    // destructor) then brings the paragraph count and metrics up to date once.
+    class Transaction {
+    public:
+        explicit Transaction(EditorWindow &w, bool keepUndo = false) : w(w), undo(w.txt->document()->isUndoRedoEnabled()) {
+            if (w.transactions++ == 0 && w.recorder) w.recorder->setPaused(true);
+            if (!keepUndo) w.txt->document()->setUndoRedoEnabled(false);
+        }
+        ~Transaction() { commit(); }
+
+        // paragraphs: the new count if the caller already knows it.
+        void commit(int paragraphs = -1) {
+            if (done) return;
+            done = true;
+            QTextDocument *doc = w.txt->document();
+            doc->setUndoRedoEnabled(undo);
+            if (--w.transactions > 0) return;
+            if (w.recorder) w.recorder->setPaused(false);
+            const qsizetype size = doc->characterCount() - 1;
+            w.lastParagraphCount = paragraphs >= 0 ? paragraphs : countParagraphs(w.txt->toPlainText());
+            watchdog::setDocumentSize(size);
+            metrics::registry().document(size, w.lastParagraphCount);
+        }
+
+    private:
+        EditorWindow &w;
+        bool undo; // as it was before
+        bool done = false;
+    };
+
+    explicit EditorWindow(QWidget *parent = nullptr) : QWidget(parent) {
+        setWindowTitle("Простий текстовий редактор (AbstractFactory + Observer)");
+        QVBoxLayout *layout = new QVBoxLayout(this);
+
+        QMenuBar *menuBar = new QMenuBar();
+        QMenu *menuFile = menuBar->addMenu("File");
+        QAction *actOpen = menuFile->addAction("Відкрити...");
+        QAction *actSave = menuFile->addAction("Зберегти...");
+        QAction *actCompare = menuFile->addAction("Порівняти з диском...");
+        menuFile->addSeparator();
+        QAction *actExit = menuFile->addAction("Вихід");
+        QMenu *menuDiag = menuBar->addMenu("Діагностика");
+        QAction *actTrace = menuDiag->addAction("Трасування");
+        actTrace->setCheckable(true);
+        actTrace->setChecked(tracing::isEnabled());
+        QAction *actTraceExport = menuDiag->addAction("Експорт трасування...");
+        menuDiag->addSeparator();
+        QAction *actMetrics = menuDiag->addAction("Метрики...");
+
+        txt = new QTextEdit();
+        txt->setAcceptRichText(false);
+        txt->installEventFilter(this);
+        layout->setMenuBar(menuBar);
+        layout->addWidget(txt);
+
+        subject.add(&msgObs);
+        lastParagraphCount = countParagraphs(txt->toPlainText());
+
+        connect(actOpen, &QAction::triggered, this, [this]() {
+            QString fname = QFileDialog::getOpenFileName(this, "Відкрити файл", "", "All Files (*.*)");
+            if (fname.isEmpty()) return;
+            openFile(fname);
+        });
+
+        connect(actSave, &QAction::triggered, this, [this]() {
+            if (currentPath.isEmpty()) {
+                QString fname = QFileDialog::getSaveFileName(this, "Зберегти файл", "", "All Files (*.*)");
+                if (fname.isEmpty()) return;
+                currentPath = fname;
+                QFileInfo fi(fname);
+                currentFactory = factoryForExtension(fi.suffix().toLower());
+            }
+            if (!saveFile()) QMessageBox::warning(this, "Помилка", "Не вдалося зберегти файл.");
+        });
+
+        connect(actCompare, &QAction::triggered, this, [this]() {
+            if (currentPath.isEmpty() || !QFileInfo::exists(currentPath)) {
+                QMessageBox::information(this, "Порівняння", "Документ ще не збережено у файл.");
+                return;
+            }
+            if (!currentFactory) currentFactory = factoryForExtension(QFileInfo(currentPath).suffix().toLower());
+            // Loaded and diffed on the pool; the view opens when it is ready.
+            struct Comparison {
+                QString disk, current;
+                diff::Result result;
+            };
+            std::shared_ptr<IFileLoader> loader = currentFactory->createLoader();
+            sched::scheduler().submit(sched::Priority::Interactive, [loader, path = currentPath, current = txt->toPlainText()]() {
+                Comparison c{loader->load(path), current, {}};
+                c.result = diff::compute(c.disk, c.current);
+                return c;
+            }, this, [this](Comparison c) {
+                if (!diffView) diffView = new diff::DiffView(this);
+                diffView->showDiff(c.disk, c.current, c.result);
+            }, &docTasks);
+        });
+
+        connect(actExit, &QAction::triggered, qApp, &QApplication::quit);
+
+        connect(actTrace, &QAction::toggled, this, [](bool on) { tracing::setEnabled(on); });
+        connect(actTraceExport, &QAction::triggered, this, [this]() {
+            QString fname = QFileDialog::getSaveFileName(this, "Експорт трасування", "trace.json", "Chrome trace (*.json)");
+            if (fname.isEmpty()) return;
+            if (!tracing::exportChromeJson(fname)) QMessageBox::warning(this, "Помилка", "Не вдалося зберегти трасування.");
+        });
+
+        connect(actMetrics, &QAction::triggered, this, [this]() {
+            if (!metricsPanel) metricsPanel = new metrics::MetricsPanel(this);
+            metricsPanel->show();
+            metricsPanel->raise();
+        });
+
+        connect(txt, &QTextEdit::textChanged, this, [this]() { onTextChanged(); });
+
+        reloadTimer.setSingleShot(true);
+        reloadTimer.setInterval(50);
+        connect(&watcher, &QFileSystemWatcher::fileChanged, this, [this]() { reloadTimer.start(); });
+        connect(&reloadTimer, &QTimer::timeout, this, [this]() { onFileChanged(); });
+
+        autosaveTimer.setSingleShot(true);
+        connect(&autosaveTimer, &QTimer::timeout, this, [this]() {
+            if (!currentPath.isEmpty()) submitAutosave(txt->toPlainText());
+        });
+    }
+
+    // Pending autosaves finish, and a load in progress is abandoned, before the window goes away.
+    ~EditorWindow() override {
+        openCancel.cancel();
+        reloadCancel.cancel();
+        autosaver.reset();
+        docTasks.wait();
+    }
+
+    // Loads fname on the pool and shows it once it is ready; the current
+    // document stays editable (and saves to its own file) until then. A newer
+    // open cancels a load still in progress.
+    void openFile(const QString &fname) {
+        OPI_TRACE_SCOPE("EditorWindow::openFile");
+        QElapsedTimer t;
+        t.start();
+        statsCancel.cancel(); // statistics of the previous document are no longer wanted
+        const cancel::Token token = openCancel.renew();
+        reloadCancel.cancel();
+        const QString ext = QFileInfo(fname).suffix().toLower();
+        std::shared_ptr<IFileLoader> loader = factoryForExtension(ext)->createLoader();
+        loader->setCancelToken(token);
+        opening = true;
+        sched::scheduler().submit(sched::Priority::Interactive, [loader, fname, token]() {
+            Loaded l;
+            l.content = loader->load(fname);
+            if (token.cancelled()) return l;
+            l.format = loader->format();
+            docstats::Stats stats;
+            if (!loader->paragraphs().empty()) {
+                l.paragraphs = int(loader->paragraphs().size());
+            } else if (docstats::load(fname, l.content, stats)) {
+                l.paragraphs = int(stats.paragraphs());
+                l.words = stats.words;
+            } else {
+                l.paragraphs = countParagraphs(l.content, token);
+            }
+            return l;
+        }, this, [this, fname, ext, token, t](Loaded l) {
+            if (token.cancelled()) return; // a newer open replaced it
+            opening = false;
+            showLoaded(fname, ext, std::move(l), t);
+        }, &docTasks);
+    }
+
+    // Blocks until the last openFile() has shown its document, for the
+    // benchmarks and replay that edit it right after.
+    void waitForOpen() {
+        while (opening) {
+            docTasks.wait();
+            QCoreApplication::processEvents();
+        }
+    }
+
+    // Explicit save to the current path; false if there is none or it failed.
+    bool saveFile() {
+        OPI_TRACE_SCOPE("EditorWindow::saveFile");
+        if (currentPath.isEmpty()) return false;
+        watchdog::ActionScope action("save");
+        QElapsedTimer t;
+        t.start();
+        autosaveTimer.stop(); // this save covers it
+        autosaver->waitForIdle(); // an older autosave must not land after this save
+        if (!currentFactory) currentFactory = factoryForExtension(QFileInfo(currentPath).suffix().toLower());
+        auto saver = currentFactory->createSaver();
+        if (currentFormat) saver->setFormat(*currentFormat);
+        const QString text = txt->toPlainText();
+        bool ok = saver->save(currentPath, text); // synced as --durability asks
+        if (ok) {
+            recordStats(currentPath, text);
+            watchFile(currentPath);
+        }
+        if (recorder) recorder->action(EditOp::Save, currentPath, t.nsecsElapsed() / 1000);
+        if (ok) notifySaved(currentPath);
+        return ok;
+    }
+
+    // Replaces the autosave backend, after letting the current one finish.
+    void setAutosaveBackend(std::unique_ptr<autosave::Backend> backend) {
+        autosaver->waitForIdle();
+        autosaver = std::move(backend);
+    }
+    autosave::Backend &autosaveBackend() { return *autosaver; }
+
+    void setRecorder(SessionRecorder *r) {
+        recorder = r;
+        if (recorder) recorder->attach(txt->document());
+    }
+
+    QTextEdit *textEdit() const { return txt; }
+    const QString &path() const { return currentPath; }
+    Subject &observers() { return subject; }
+    IObserver *messageObserver() { return &msgObs; }
+    const EditorProfile &profile() const { return prof; }
+
+protected:
+    // Paste is handled here so the stall watchdog can label it.
+    bool eventFilter(QObject *o, QEvent *e) override {
+        if (o == txt && e->type() == QEvent::KeyPress && static_cast<QKeyEvent *>(e)->matches(QKeySequence::Paste)) {
+            watchdog::ActionScope action("paste");
+            txt->paste();
+            return true;
+        }
+        return QWidget::eventFilter(o, e);
+    }
+
+private:
+    void notifySaved(const QString &path) {
+        QElapsedTimer t;
+        t.start();
+        subject.notifySaved(path);
+        prof.notify.add(t.nsecsElapsed());
+    }
+
+    // What openFile() reads on the pool.
+    struct Loaded {
+        QString content;
+        TextFormat format;
+        int paragraphs = -1;
+        qint64 words = -1; // from stored statistics
+    };
+
+    // Puts a loaded file in the window (GUI thread).
+    void showLoaded(const QString &fname, const QString &ext, Loaded l, const QElapsedTimer &t) {
+        watchdog::ActionScope action("open");
+        autosaveTimer.stop();
+        currentPath = fname; // before the text changes, so nothing lands in the old file
+        currentFactory = factoryForExtension(ext);
+        currentFormat = l.format;
+        {
+            Transaction tx(*this);
+            txt->setPlainText(l.content);
+            tx.commit(l.paragraphs);
+        }
+        if (l.words >= 0) metrics::registry().documentWords(l.words);
+        metrics::registry().load(ext, t.nsecsElapsed());
+        watchFile(fname);
+        if (recorder) recorder->action(EditOp::Open, fname, t.nsecsElapsed() / 1000);
+    }
+
+    // Counts the saved text in the background and stores the result next to
+    // the file for the next open. A newer save or another open cancels a
+    // count still in progress.
+    void recordStats(const QString &path, const QString &text) {
+        const cancel::Token token = statsCancel.renew();
+        sched::scheduler().submit(sched::Priority::Background, [path, text, token]() {
+            const docstats::Stats stats = docstats::compute(text, token);
+            if (token.cancelled()) return qint64(-1);
+            docstats::store(path, text, stats);
+            return stats.words;
+        }, this, [token](qint64 words) {
+            if (words >= 0 && !token.cancelled()) metrics::registry().documentWords(words);
+        }, &docTasks);
+    }
+
+    // Watches path and records its current state as ours.
+    void watchFile(const QString &path) {
+        if (!watcher.files().isEmpty()) watcher.removePaths(watcher.files());
+        watcher.addPath(path);
+        setDiskStamp(path, reload::stamp(path));
+        syncedRevision = txt->document()->revision();
+    }
+
+    void setDiskStamp(const QString &path, const reload::DiskStamp &stamp) {
+        std::lock_guard<std::mutex> lock(diskMu);
+        disk.path = path;
+        disk.stamp = stamp;
+    }
+    reload::DiskStamp diskStamp(const QString &path) {
+        std::lock_guard<std::mutex> lock(diskMu);
+        return disk.path == path ? disk.stamp : reload::DiskStamp();
+    }
+
+    // Brings the document up to date with a file another process changed:
+    // appended bytes are decoded and inserted on their own; any other change
+    // reloads the file and replaces only the paragraphs that differ, unless
+    // there are unsaved edits, which are kept.
+    void onFileChanged() {
+        if (currentPath.isEmpty()) return;
+        OPI_TRACE_SCOPE("EditorWindow::onFileChanged");
+        // A save by rename (ours or another editor's) drops the watch.
+        if (!watcher.files().contains(currentPath) && QFileInfo::exists(currentPath)) watcher.addPath(currentPath);
+        // Our own writes are stamped when they land; until the pending ones
+        // have, the change may be one of them. onAutosaved() checks again.
+        if (autosavesInFlight > 0) {
+            recheckDisk = true;
+            return;
+        }
+        const reload::DiskStamp known = diskStamp(currentPath);
+        const reload::DiskStamp now = reload::stamp(currentPath);
+        if (now.size < 0 || now == known) return;
+
+        QTextDocument *doc = txt->document();
+        const bool clean = doc->revision() == syncedRevision;
+        if (!currentFactory) currentFactory = factoryForExtension(QFileInfo(currentPath).suffix().toLower());
+        reload::Appended added;
+        if (currentFactory->createLoader()->appendable() &&
+            reload::readAppended(currentPath, known, currentFormat.value_or(TextFormat()).encoding, added)) {
+            Transaction tx(*this, true); // the append is one undo step
+            int paragraphs = lastParagraphCount; // known without recounting the document
+            if (!added.text.isEmpty()) {
+                const QTextBlock last = doc->lastBlock();
+                QString tail = last.text();
+                if (last.previous().isValid()) tail.prepend(last.previous().text() + u'\n');
+                paragraphs = countParagraphsAppended(paragraphs, tail, added.text);
+                QTextCursor c(doc);
+                c.movePosition(QTextCursor::End);
+                c.insertText(added.text);
+            }
+            setDiskStamp(currentPath, added.stamp);
+            tx.commit(paragraphs);
+            if (clean) syncedRevision = doc->revision();
+        } else if (clean) {
+            reloadFile(now);
+        } else {
+            keepEdits(now);
+        }
+    }
+
+    void keepEdits(const reload::DiskStamp &now) {
+        qInfo("%s changed on disk; keeping the unsaved edits", qPrintable(currentPath));
+        setDiskStamp(currentPath, now);
+    }
+
+    // Loads the file and diffs it against the document on the pool, then
+    // replaces the paragraphs that differ, unless the document was edited or
+    // the file changed again in the meantime. A newer reload or open cancels it.
+    void reloadFile(const reload::DiskStamp &now) {
+        struct Reloaded {
+            QString text;
+            TextFormat format;
+            diff::Result result;
+            int paragraphs = -1;
+        };
+        const cancel::Token token = reloadCancel.renew();
+        std::shared_ptr<IFileLoader> loader = currentFactory->createLoader();
+        loader->setCancelToken(token);
+        const int revision = txt->document()->revision();
+        sched::scheduler().submit(sched::Priority::Visible, [loader, path = currentPath, current = txt->toPlainText(), token]() {
+            Reloaded r;
+            r.text = loader->load(path);
+            if (token.cancelled()) return r;
+            r.format = loader->format();
+            r.result = diff::compute(current, r.text);
+            r.paragraphs = countParagraphs(r.text, token);
+            return r;
+        }, this, [this, path = currentPath, now, revision, token](Reloaded r) {
+            if (token.cancelled() || path != currentPath) return;
+            if (reload::stamp(path) != now) {
+                reloadTimer.start(); // changed again: look at the newest version
+                return;
+            }
+            QTextDocument *doc = txt->document();
+            if (doc->revision() != revision) {
+                keepEdits(now);
+                return;
+            }
+            Transaction tx(*this, true); // the reload is one undo step
+            reload::applyDiff(doc, r.result, r.text);
+            currentFormat = r.format;
+            setDiskStamp(path, now);
+            tx.commit(r.paragraphs);
+            syncedRevision = doc->revision();
+        }, &docTasks);
+    }
+
+    // Runs on the GUI thread once the backend has written (or skipped) a snapshot.
+    void onAutosaved(const autosave::Outcome &o, const QString &text, int revision) {
+        if (--autosavesInFlight == 0 && recheckDisk) {
+            recheckDisk = false;
+            reloadTimer.start();
+        }
+        if (o.dropped) {
+            // Over the byte budget: try again with whatever the text is by then.
+            if (o.path == currentPath && !autosaveTimer.isActive())
+                autosaveTimer.start(qMax(autosave::Bounded::minDelayMs, autosaver->suggestedDelayMs()));
+            return;
+        }
+        if (o.superseded) return;
+        prof.autosave.add(o.ns);
+        metrics::registry().autosave(o.ns, o.bytes);
+        if (recorder) recorder->action(EditOp::AutoSave, o.path, o.ns / 1000);
+        if (!o.ok) return;
+        if (o.path == currentPath && revision == txt->document()->revision()) syncedRevision = revision;
+        recordStats(o.path, text);
+        notifySaved(o.path);
+    }
+
+    void onTextChanged() {
+        if (transactions > 0) return; // Transaction::commit() catches up
+        OPI_TRACE_SCOPE("textChanged");
+        watchdog::ActionScope action("edit", false);
+        QElapsedTimer handler;
+        handler.start();
+        QString text = txt->toPlainText();
+        watchdog::setDocumentSize(text.size());
+        QElapsedTimer t;
+        t.start();
+        int curCount = countParagraphs(text);
+        prof.counting.add(t.nsecsElapsed());
+        if (curCount < lastParagraphCount) {
+            int deleted = lastParagraphCount - curCount;
+            t.restart();
+            subject.notifyDeleted(deleted);
+            prof.notify.add(t.nsecsElapsed());
+        } else if (curCount > lastParagraphCount) {
+            if (!currentPath.isEmpty()) requestAutosave(text);
+        }
+        lastParagraphCount = curCount;
+        metrics::registry().document(text.size(), curCount);
+        prof.handler.add(handler.nsecsElapsed());
+        metrics::registry().keystroke(handler.nsecsElapsed());
+    }
+
+    // Autosaves at once unless the backend is behind; then the snapshot is
+    // taken when its suggested delay runs out, with everything typed by then.
+    void requestAutosave(const QString &text) {
+        if (autosaveTimer.isActive()) return;
+        const int delay = autosaver->suggestedDelayMs();
+        if (delay > 0) autosaveTimer.start(delay);
+        else submitAutosave(text);
+    }
+
+    void submitAutosave(const QString &text) {
+        OPI_TRACE_SCOPE("autosave");
+        watchdog::ActionScope action("autosave");
+        if (!currentFactory) currentFactory = factoryForExtension(QFileInfo(currentPath).suffix().toLower());
+        std::shared_ptr<IFileSaver> saver = currentFactory->createSaver();
+        if (currentFormat) saver->setFormat(*currentFormat);
+        const int revision = txt->document()->revision();
+        ++autosavesInFlight;
+        autosaver->submit({currentPath, std::move(saver), text},
+                          [this, text, revision](const autosave::Outcome &o) {
+                              // Stamped here, before the watcher can report our own write.
+                              if (o.ok && !o.superseded) setDiskStamp(o.path, reload::stamp(o.path));
+                              QMetaObject::invokeMethod(this, [this, o, text, revision]() { onAutosaved(o, text, revision); },
+                                                        Qt::QueuedConnection);
+                          });
+    }
+};
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QList>
+#include <QObject>
+#include <QString>
+#include <QTextCursor>
+#include <QTextDocument>
+#include <QtGlobal>
+
+// ---------------- Edit traces ----------------
+// One recorded event. For edits, `removed` characters at `pos` were replaced
+// by `text` (as QTextDocument::contentsChange sees it; positions are
+// plain-text character offsets). For Open/Save/AutoSave, `text` is the path
+// and `durationUs` how long the action took.
+struct EditOp {
+    enum Kind : quint8 { Edit, Open, Save, AutoSave };
+    Kind kind = Edit;
+    qint64 atMs = 0;   // time since the start of the trace
+    int pos = 0;
+    int removed = 0;
+    QString text;
+    qint64 durationUs = 0;
+};
+
+using EditTrace = QList<EditOp>;
+
+// Applies op to a plain-text copy of the document, clamping out-of-range edits.
+inline void applyEdit(QString &doc, const EditOp &op) {
+    const int pos = qBound(0, op.pos, int(doc.size()));
+    const int removed = qBound(0, op.removed, int(doc.size()) - pos);
+    doc.replace(pos, removed, op.text);
+}
+
+// ---------------- Binary trace format ----------------
+// "OPITRC1\n", then one record per event:
+//   kind:u8, delta_ms, pos, removed, duration_us, text_len (all LEB128
+//   varints), text as UTF-8.
+namespace tracefmt {
+
+inline const char magic[] = "OPITRC1\n";
+constexpr int magicSize = 8;
+
+inline void putVarint(QByteArray &out, quint64 v) {
+    while (v >= 0x80) {
+        out.append(char(v | 0x80));
+        v >>= 7;
+    }
+    out.append(char(v));
+}
+
+inline bool getVarint(const char *&p, const char *end, quint64 &v) {
+    v = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        const quint8 b = quint8(*p++);
+        v |= quint64(b & 0x7F) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+inline void encode(QByteArray &out, const EditOp &op, qint64 prevMs) {
+    out.append(char(op.kind));
+    putVarint(out, quint64(qMax<qint64>(0, op.atMs - prevMs)));
+    putVarint(out, quint64(qMax(0, op.pos)));
+    putVarint(out, quint64(qMax(0, op.removed)));
+    putVarint(out, quint64(qMax<qint64>(0, op.durationUs)));
+    const QByteArray text = op.text.toUtf8();
+    putVarint(out, quint64(text.size()));
+    out.append(text);
+}
+
+} // namespace tracefmt
+
+// Reads a whole trace; returns false on a bad header. A truncated tail (the
+// app crashed mid-write) is dropped silently.
+inline bool readTrace(const QString &path, EditTrace &trace) {
+    QFile f(path);
+    if (!f.open(QIODevice::ReadOnly)) return false;
+    const QByteArray bytes = f.readAll();
+    if (!bytes.startsWith(QByteArray(tracefmt::magic, tracefmt::magicSize))) return false;
+    const char *p = bytes.constData() + tracefmt::magicSize;
+    const char *end = bytes.constData() + bytes.size();
+    qint64 atMs = 0;
+    while (p < end) {
+        EditOp op;
+        const quint8 kind = quint8(*p++);
+        quint64 delta, pos, removed, duration, len;
+        if (kind > EditOp::AutoSave) break;
+        if (!tracefmt::getVarint(p, end, delta) || !tracefmt::getVarint(p, end, pos)
+            || !tracefmt::getVarint(p, end, removed) || !tracefmt::getVarint(p, end, duration)
+            || !tracefmt::getVarint(p, end, len) || quint64(end - p) < len) break;
+        op.kind = EditOp::Kind(kind);
+        op.atMs = atMs += qint64(delta);
+        op.pos = int(pos);
+        op.removed = int(removed);
+        op.durationUs = qint64(duration);
+        op.text = QString::fromUtf8(p, qsizetype(len));
+        p += len;
+        trace.append(op);
+    }
+    return true;
+}
+
+// ---------------- Recorder ----------------
+// Opt-in session recorder: every contentsChange of the attached document plus
+// open/save/autosave actions, appended to a compact binary trace.
+class SessionRecorder {
+    QFile file;
+    QByteArray buf;
+    QElapsedTimer clock;
+    qint64 lastMs = 0;
+    bool paused = false;
+    QMetaObject::Connection conn;
+
+public:
+    ~SessionRecorder() {
+        QObject::disconnect(conn);
+        flush();
+    }
+
+    bool start(const QString &path) {
+        file.setFileName(path);
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) return false;
+        buf.append(tracefmt::magic, tracefmt::magicSize);
+        clock.start();
+        return true;
+    }
+    bool isActive() const { return file.isOpen(); }
+
+    void attach(QTextDocument *doc) {
+        QObject::disconnect(conn);
+        conn = QObject::connect(doc, &QTextDocument::contentsChange, doc, [this, doc](int pos, int removed, int added) {
+            if (paused) return;
+            EditOp op;
+            op.pos = pos;
+            op.removed = removed;
+            if (added > 0) {
+                QTextCursor c(doc);
+                c.setPosition(pos);
+                c.setPosition(qMin(pos + added, doc->characterCount() - 1), QTextCursor::KeepAnchor);
+                op.text = c.selectedText().replace(QChar::ParagraphSeparator, QChar('\n'));
+            }
+            record(op);
+        });
+    }
+
+    // Programmatic bulk changes (loading a file) are not user edits.
+    void setPaused(bool p) { paused = p; }
+
+    void action(EditOp::Kind kind, const QString &path, qint64 durationUs) {
+        EditOp op;
+        op.kind = kind;
+        op.text = path;
+        op.durationUs = durationUs;
+        record(op);
+        flush();
+    }
+
+    void record(EditOp op) {
+        if (!file.isOpen()) return;
+        op.atMs = clock.elapsed();
+        tracefmt::encode(buf, op, lastMs);
+        lastMs = op.atMs;
+        if (buf.size() >= (64 << 10)) flush();
+    }
+
+    void flush() {
+        if (!file.isOpen() || buf.isEmpty()) return;
+        file.write(buf);
+        file.flush();
+        buf.clear();
+    }
+};
@@ -0,0 +1,343 @@
+#pragma once
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+#include <QStringList>
+#include <memory>
+#include <vector>
+
+#include "cancel.h"
+#include "durable.h"
+#include "parsecache.h"
+#include "textcodec.h"
+#include "textwriter.h"
+#include "tracing.h"
+
+inline std::vector<qint64> paragraphStarts(const QString &text);
+
+// ---------------- Interfaces for Abstract Factory ----------------
+class IFileLoader {
+public:
+    virtual ~IFileLoader() = default;
+    virtual QString load(const QString &path) = 0;
+    // True if appending bytes to the file appends their decoding to the text,
+    // so a growing file can be followed without reloading it.
+    virtual bool appendable() const { return true; }
+    // Conventions of the last loaded file (line endings), for the saver.
+    const TextFormat &format() const { return fmt; }
+    // Paragraph start offsets of the last loaded text if the loader already
+    // had them (parse cache); empty otherwise. Every load() clears them
+    // first, so a reused loader never reports the previous file's index.
+    const std::vector<qint64> &paragraphs() const { return paras; }
+    // Once the token is cancelled load() gives up and returns an empty string.
+    void setCancelToken(const cancel::Token &t) { cancelToken = t; }
+    bool cancelled() const { return cancelToken.cancelled(); }
+
+protected:
+    TextFormat fmt;
+    std::vector<qint64> paras;
+    cancel::Token cancelToken;
+
+    // readAll() in chunks, polling the token between them.
+    QByteArray readFile(QFile &f) {
+        static constexpr qint64 chunk = qint64(16) << 20;
+        QByteArray bytes;
+        const qint64 size = f.size();
+        if (size <= chunk) return f.readAll();
+        bytes.resize(qsizetype(size));
+        qint64 got = 0;
+        while (got < size) {
+            if (cancelled()) return {};
+            const qint64 n = f.read(bytes.data() + got, qMin(chunk, size - got));
+            if (n <= 0) break;
+            got += n;
+        }
+        bytes.truncate(qsizetype(got));
+        return bytes;
+    }
+
+    // Loads through the parse cache: convert() runs only on a miss.
+    template <class Convert>
+    QString loadCached(const QString &path, const QByteArray &bytes, Convert convert) {
+        parsecache::Entry e;
+        if (parsecache::cache().lookup(path, bytes, e)) {
+            fmt = e.format;
+            paras = std::move(e.paragraphs);
+            return e.text;
+        }
+        e.text = convert();
+        if (cancelled()) return {};
+        if (parsecache::cache().enabled() && bytes.size() >= parsecache::Cache::minSourceSize) {
+            e.format = fmt;
+            e.paragraphs = paragraphStarts(e.text);
+            parsecache::cache().store(path, bytes, e);
+            paras = std::move(e.paragraphs);
+        }
+        return e.text;
+    }
+};
+
+class IFileSaver {
+public:
+    virtual ~IFileSaver() = default;
+    // Replaces path atomically (see durable.h); false leaves the old file intact.
+    virtual bool save(const QString &path, const QString &text) = 0;
+    // Serialises text in this format; save() and the autosave backends use it.
+    virtual void encode(utf8::Writer &out, const QString &text) = 0;
+    // Usually the loader's format(), so a file keeps its line endings.
+    void setFormat(const TextFormat &f) { fmt = f; }
+    // Autosaves are synced to disk less eagerly (see durable.h).
+    void setKind(durable::Kind k) { kind = k; }
+    // Once the token is cancelled save() stops writing at its next chunk and
+    // returns false, leaving the old file in place.
+    void setCancelToken(const cancel::Token &t) { cancelToken = t; }
+    const cancel::Token &token() const { return cancelToken; }
+    bool cancelled() const { return cancelToken.cancelled(); }
+
+protected:
+    TextFormat fmt;
+    durable::Kind kind = durable::Kind::Explicit;
+    cancel::Token cancelToken;
+};
+
+class IFileFactory {
+public:
+    virtual ~IFileFactory() = default;
+    virtual std::unique_ptr<IFileLoader> createLoader() = 0;
+    virtual std::unique_ptr<IFileSaver> createSaver() = 0;
+};
+
+// ---------------- TXT ----------------
+class TXTLoader : public IFileLoader {
+public:
+    QString load(const QString &path) override {
+        OPI_TRACE_SCOPE("TXTLoader::load");
+        paras.clear();
+        QFile f(path);
+        if (!f.open(QIODevice::ReadOnly)) return {};
+        const QByteArray bytes = readFile(f);
+        if (cancelled()) return {};
+        return textcodec::decode(bytes, fmt);
+    }
+};
+class TXTSaver : public IFileSaver {
+public:
+    bool save(const QString &path, const QString &text) override {
+        OPI_TRACE_SCOPE("TXTSaver::save");
+        durable::AtomicFile f(path, kind);
+        if (!f.open()) return false;
+        utf8::Writer out(f.device());
+        out.setCancelToken(cancelToken);
+        encode(out, text);
+        return out.flush() && f.commit();
+    }
+    void encode(utf8::Writer &out, const QString &text) override {
+        out.start(fmt);
+        out << text;
+    }
+};
+class TXTFactory : public IFileFactory {
+public:
+    std::unique_ptr<IFileLoader> createLoader() override { return std::make_unique<TXTLoader>(); }
+    std::unique_ptr<IFileSaver>  createSaver() override { return std::make_unique<TXTSaver>(); }
+};
+
+// ---------------- HTML ----------------
+// Empty if the token is cancelled part way.
+inline QString htmlToPlain(const QString &html, const cancel::Token &cancelToken = {}) {
+    OPI_TRACE_SCOPE("htmlToPlain");
+    QString s = html;
+    QString out;
+    bool inTag = false;
+    QString tag;
+    for (int i = 0; i < s.size(); ++i) {
+        if (i % cancel::pollEvery == 0 && cancelToken.cancelled()) return {};
+        QChar c = s[i];
+        if (c == '<') { inTag = true; tag.clear(); continue; }
+        if (inTag) {
+            if (c == '>') {
+                inTag = false;
+                QString t = tag.trimmed().toLower();
+                if (t.startsWith("br") || t.startsWith("br/")) out += "\n\n";
+                if (t.startsWith("p") || t.startsWith("/p")) out += "\n\n";
+            } else {
+                tag += c;
+            }
+            continue;
+        }
+        if (!inTag) out += c;
+    }
+    QStringList lines = out.split('\n');
+    QString result;
+    int emptyCount = 0;
+    qsizetype seen = 0;
+    for (QString ln : lines) {
+        if (++seen % cancel::pollEvery == 0 && cancelToken.cancelled()) return {};
+        if (ln.trimmed().isEmpty()) { emptyCount++; if (emptyCount <= 2) result += "\n"; }
+        else { emptyCount = 0; result += ln + "\n"; }
+    }
+    return result.trimmed();
+}
+
+class HTMLLoader : public IFileLoader {
+public:
+    bool appendable() const override { return false; }
+    QString load(const QString &path) override {
+        OPI_TRACE_SCOPE("HTMLLoader::load");
+        paras.clear();
+        QFile f(path);
+        if (!f.open(QIODevice::ReadOnly)) return {};
+        const QByteArray bytes = readFile(f);
+        if (cancelled()) return {};
+        return loadCached(path, bytes, [&] { return htmlToPlain(textcodec::decode(bytes, fmt), cancelToken); });
+    }
+};
+class HTMLSaver : public IFileSaver {
+public:
+    bool save(const QString &path, const QString &text) override {
+        OPI_TRACE_SCOPE("HTMLSaver::save");
+        durable::AtomicFile f(path, kind);
+        if (!f.open()) return false;
+        utf8::Writer out(f.device());
+        out.setCancelToken(cancelToken);
+        encode(out, text);
+        return out.flush() && f.commit();
+    }
+
+    void encode(utf8::Writer &out, const QString &text) override {
+        out.start(fmt);
+        out << "<html><body>\n";
+        // Same paragraphs as text.split("\n\n", Qt::SkipEmptyParts), without the copies.
+        const QStringView all(text);
+        qsizetype from = 0;
+        while (from <= all.size()) {
+            qsizetype end = all.indexOf(u"\n\n", from);
+            if (end < 0) end = all.size();
+            if (!out.ok()) return; // cancelled or failed
+            if (end > from) {
+                out << "<p>";
+                writeEscaped(out, all.mid(from, end - from));
+                out << "</p>\n";
+            }
+            from = end + 2;
+        }
+        out << "\n</body></html>\n";
+    }
+
+private:
+    // Streams what QString::toHtmlEscaped() would produce.
+    static void writeEscaped(utf8::Writer &out, QStringView s) {
+        qsizetype run = 0;
+        for (qsizetype i = 0; i < s.size(); ++i) {
+            const char *entity;
+            switch (s[i].unicode()) {
+            case '<': entity = "&lt;"; break;
+            case '>': entity = "&gt;"; break;
+            case '&': entity = "&amp;"; break;
+            case '"': entity = "&quot;"; break;
+            default: continue;
+            }
+            out << s.mid(run, i - run) << entity;
+            run = i + 1;
+        }
+        out << s.mid(run);
+    }
+};
+class HTMLFactory : public IFileFactory {
+public:
+    std::unique_ptr<IFileLoader> createLoader() override { return std::make_unique<HTMLLoader>(); }
+    std::unique_ptr<IFileSaver>  createSaver() override { return std::make_unique<HTMLSaver>(); }
+};
+
+// ---------------- BIN ----------------
+class BINLoader : public IFileLoader {
+public:
+    QString load(const QString &path) override {
+        OPI_TRACE_SCOPE("BINLoader::load");
+        paras.clear();
+        QFile f(path);
+        if (!f.open(QIODevice::ReadOnly)) return {};
+        const QByteArray bytes = readFile(f);
+        if (cancelled()) return {};
+        return loadCached(path, bytes, [&] { return textcodec::decode(bytes, fmt); });
+    }
+};
+
+class BINSaver : public IFileSaver {
+public:
+    BINSaver() { fmt.newline = Newline::Lf; } // same bytes on every platform
+    bool save(const QString &path, const QString &text) override {
+        OPI_TRACE_SCOPE("BINSaver::save");
+        durable::AtomicFile f(path, kind);
+        if (!f.open()) return false;
+        utf8::Writer out(f.device());
+        out.setCancelToken(cancelToken);
+        encode(out, text);
+        return out.flush() && f.commit();
+    }
+    void encode(utf8::Writer &out, const QString &text) override {
+        out.start(fmt);
+        out << text;
+    }
+};
+
+class BINFactory : public IFileFactory {
+public:
+    std::unique_ptr<IFileLoader> createLoader() override { return std::make_unique<BINLoader>(); }
+    std::unique_ptr<IFileSaver>  createSaver() override { return std::make_unique<BINSaver>(); }
+};
+
+// Picks the factory for a file extension; unknown extensions are treated as TXT.
+inline std::unique_ptr<IFileFactory> factoryForExtension(const QString &ext) {
+    if (ext == "txt") return std::make_unique<TXTFactory>();
+    if (ext == "html" || ext == "htm") return std::make_unique<HTMLFactory>();
+    if (ext == "bin") return std::make_unique<BINFactory>();
+    return std::make_unique<TXTFactory>();
+}
+
+// ---------------- Utility: paragraph counting ----------------
+// A cancelled token stops the count part way; check it before using the result.
+inline int countParagraphs(const QString &text, const cancel::Token &cancelToken = {}) {
+    OPI_TRACE_SCOPE("countParagraphs");
+    QStringList paras;
+    QStringList lines = text.split('\n');
+    QString cur;
+    qsizetype seen = 0;
+    for (QString ln : lines) {
+        if (++seen % cancel::pollEvery == 0 && cancelToken.cancelled()) break;
+        if (ln.trimmed().isEmpty()) {
+            if (!cur.isEmpty()) { paras << cur; cur.clear(); }
+        } else {
+            if (!cur.isEmpty()) cur += "\n";
+            cur += ln;
+        }
+    }
+    if (!cur.isEmpty()) paras << cur;
+    return paras.count();
+}
+
+// countParagraphs(text + added) for a text with `paragraphs` paragraphs whose
+// last two lines are tail, in time proportional to added: the first line of
+// tail decides whether a paragraph runs on across the old end.
+inline int countParagraphsAppended(int paragraphs, const QString &tail, const QString &added) {
+    return paragraphs - countParagraphs(tail) + countParagraphs(tail + added);
+}
+
+// Offsets of the first line of each paragraph as countParagraphs() sees them
+// (runs of lines that are not blank), so paragraphStarts(t).size() == countParagraphs(t).
+inline std::vector<qint64> paragraphStarts(const QString &text) {
+    std::vector<qint64> starts;
+    const QStringView all(text);
+    bool inParagraph = false;
+    qsizetype from = 0;
+    while (from <= all.size()) {
+        qsizetype end = all.indexOf(u'\n', from);
+        if (end < 0) end = all.size();
+        const bool blank = all.mid(from, end - from).trimmed().isEmpty();
+        if (!blank && !inParagraph) starts.push_back(from);
+        inParagraph = !blank;
+        from = end + 1;
+    }
+    return starts;
+}
@@ -1,289 +1,112 @@
 #include <QApplication>
-#include <QWidget>
-#include <QVBoxLayout>
-#include <QMenuBar>
-#include <QMenu>
-#include <QFileDialog>
-#include <QTextStream>
+#include <QCommandLineParser>
 #include <QMessageBox>
-#include <QFileInfo>
-#include <QByteArray>
-#include <QFile>
-#include <QString>
-#include <QTextEdit>
-#include <QPushButton>
-#include <QTimer>
-#include <memory>
+#include <QStandardPaths>
+
+#include "cpu.h"
+#include "editor.h"
+#include "durable.h"
+#include "edittrace.h"
+#include "metrics.h"
+#include "parsecache.h"
+#include "profiler.h"
+#include "replay.h"
+#include "tracing.h"
+#include "watchdog.h"
 
-// ---------------- Interfaces for Abstract Factory ----------------
-class IFileLoader {
-public:
-    virtual ~IFileLoader() = default;
-    virtual QString load(const QString &path) = 0;
-};
-
-class IFileSaver {
-public:
-    virtual ~IFileSaver() = default;
-    virtual bool save(const QString &path, const QString &text) = 0;
-};
-
-class IFileFactory {
-public:
-    virtual ~IFileFactory() = default;
-    virtual std::unique_ptr<IFileLoader> createLoader() = 0;
-    virtual std::unique_ptr<IFileSaver> createSaver() = 0;
-};
-
-// ---------------- TXT ----------------
-class TXTLoader : public IFileLoader {
-public:
-    QString load(const QString &path) override {
-        QFile f(path);
-        if (!f.open(QIODevice::ReadOnly | QIODevice::Text)) return {};
-        QTextStream in(&f);
-        return in.readAll();
-    }
-};
-class TXTSaver : public IFileSaver {
-public:
-    bool save(const QString &path, const QString &text) override {
-        QFile f(path);
-        if (!f.open(QIODevice::WriteOnly | QIODevice::Text)) return false;
-        QTextStream out(&f);
-        out << text;
-        return true;
-    }
-};
-class TXTFactory : public IFileFactory {
-public:
-    std::unique_ptr<IFileLoader> createLoader() override { return std::make_unique<TXTLoader>(); }
-    std::unique_ptr<IFileSaver>  createSaver() override { return std::make_unique<TXTSaver>(); }
-};
-
-// ---------------- HTML ----------------
-static QString htmlToPlain(const QString &html) {
-    QString s = html;
-    QString out;
-    bool inTag = false;
-    QString tag;
-    for (int i = 0; i < s.size(); ++i) {
-        QChar c = s[i];
-        if (c == '<') { inTag = true; tag.clear(); continue; }
-        if (inTag) {
-            if (c == '>') {
-                inTag = false;
-                QString t = tag.trimmed().toLower();
-                if (t.startsWith("br") || t.startsWith("br/")) out += "\n\n";
-                if (t.startsWith("p") || t.startsWith("/p")) out += "\n\n";
-            } else {
-                tag += c;
-            }
-            continue;
-        }
-        if (!inTag) out += c;
-    }
-    QStringList lines = out.split('\n');
-    QString result;
-    int emptyCount = 0;
-    for (QString ln : lines) {
-        if (ln.trimmed().isEmpty()) { emptyCount++; if (emptyCount <= 2) result += "\n"; }
-        else { emptyCount = 0; result += ln + "\n"; }
-    }
-    return result.trimmed();
-}
-
-class HTMLLoader : public IFileLoader {
-public:
-    QString load(const QString &path) override {
-        QFile f(path);
-        if (!f.open(QIODevice::ReadOnly | QIODevice::Text)) return {};
-        QByteArray bytes = f.readAll();
-        QString html = QString::fromUtf8(bytes);
-        return htmlToPlain(html);
-    }
-};
-class HTMLSaver : public IFileSaver {
-public:
-    bool save(const QString &path, const QString &text) override {
-        QFile f(path);
-        if (!f.open(QIODevice::WriteOnly | QIODevice::Text)) return false;
-        QTextStream out(&f);
-        out << "<html><body>\n";
-        QStringList paras = text.split("\n\n", Qt::SkipEmptyParts);
-        for (const QString &p : paras) {
-            out << "<p>" << p.toHtmlEscaped() << "</p>\n";
-        }
-        out << "\n</body></html>\n";
-        return true;
-    }
-};
-class HTMLFactory : public IFileFactory {
-public:
-    std::unique_ptr<IFileLoader> createLoader() override { return std::make_unique<HTMLLoader>(); }
-    std::unique_ptr<IFileSaver>  createSaver() override { return std::make_unique<HTMLSaver>(); }
-};
-
-// ---------------- BIN ----------------
-class BINLoader : public IFileLoader {
-public:
-    QString load(const QString &path) override {
-        QFile f(path);
-        if (!f.open(QIODevice::ReadOnly)) return {};
-        QByteArray bytes = f.readAll();
-        return QString::fromUtf8(bytes);
-    }
-};
+int main(int argc, char *argv[]) {
+    QApplication app(argc, argv);
 
-class BINSaver : public IFileSaver {
-public:
-    bool save(const QString &path, const QString &text) override {
-        QFile f(path);
-        if (!f.open(QIODevice::WriteOnly)) return false;
-        QByteArray bytes = text.toUtf8();
-        f.write(bytes);
-        return true;
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption recordOpt("record", "Record the edit session to a trace file (or set OPI_RECORD_TRACE).", "trace");
+    QCommandLineOption replayOpt("replay", "Replay a recorded trace and print a profile.", "trace");
+    QCommandLineOption speedOpt("replay-speed", "recorded or max.", "speed", "recorded");
+    QCommandLineOption fileOpt("replay-file", "Starting file for the replay instead of the recorded one.", "file");
+    QCommandLineOption traceOpt("trace", "Record tracing spans from startup (or set OPI_TRACE=1).");
+    QCommandLineOption traceOutOpt("trace-out", "Write a Chrome trace JSON file on exit.", "file");
+    QCommandLineOption stallOpt("stall-ms", "Report UI stalls longer than this (0 disables; or set OPI_STALL_MS).", "ms", "50");
+    QCommandLineOption stallLogOpt("stall-log", "Also append stall reports to this file.", "file");
+    QCommandLineOption profileOpt("profile", "Sample CPU stacks and write folded stacks to this file on exit (Linux).", "file");
+    QCommandLineOption profileHzOpt("profile-hz", "Sampling rate for --profile.", "hz", "97");
+    QCommandLineOption autosaveOpt("autosave-backend", "auto, uring, threads or sync (or set OPI_AUTOSAVE_BACKEND).", "kind", "auto");
+    QCommandLineOption durabilityOpt("durability", "none, save (fsync explicit saves) or group (or set OPI_DURABILITY).", "mode", "save");
+    QCommandLineOption budgetOpt("autosave-budget-mb", "Memory for autosave snapshots waiting for the disk.", "mb", "256");
+    QCommandLineOption groupMsOpt("group-commit-ms", "Window in which autosaves share one sync with --durability group.", "ms", "100");
+    QCommandLineOption metricsOpt("metrics-port", "Serve Prometheus metrics on 127.0.0.1:<port>/metrics.", "port");
+    QCommandLineOption cacheDirOpt("parse-cache-dir", "Where converted HTML/BIN documents are cached.", "dir",
+                                   QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/parse");
+    QCommandLineOption cacheMbOpt("parse-cache-mb", "Size cap of the parse cache (0 disables it).", "mb", "256");
+    parser.addOptions({recordOpt, replayOpt, speedOpt, fileOpt, traceOpt, traceOutOpt, stallOpt, stallLogOpt, profileOpt, profileHzOpt,
+                       autosaveOpt, budgetOpt, durabilityOpt, groupMsOpt, metricsOpt, cacheDirOpt, cacheMbOpt});
+    parser.process(app);
+
+    cpu::level(); // detect the CPU (and honour OPI_CPU_LEVEL) before any kernel runs
+
+    if (parser.isSet(traceOpt) || parser.isSet(traceOutOpt) || qEnvironmentVariableIntValue("OPI_TRACE"))
+        tracing::setEnabled(true);
+
+    std::unique_ptr<profiler::SamplingProfiler> sampler;
+    if (parser.isSet(profileOpt)) {
+        sampler = std::make_unique<profiler::SamplingProfiler>(parser.value(profileOpt), parser.value(profileHzOpt).toInt());
+        if (!sampler->start()) sampler.reset();
     }
-};
-
-class BINFactory : public IFileFactory {
-public:
-    std::unique_ptr<IFileLoader> createLoader() override { return std::make_unique<BINLoader>(); }
-    std::unique_ptr<IFileSaver>  createSaver() override { return std::make_unique<BINSaver>(); }
-};
 
-// ---------------- Observer ----------------
-class IObserver {
-public:
-    virtual ~IObserver() = default;
-    virtual void onParagraphsDeleted(int count) = 0;
-    virtual void onAutoSaved(const QString &path) = 0;
-};
-
-class Subject {
-    QList<IObserver*> obs;
-public:
-    void add(IObserver* o) { if (o && !obs.contains(o)) obs.append(o); }
-    void remove(IObserver* o) { obs.removeAll(o); }
-
-    void notifyDeleted(int n) { for (auto o : obs) o->onParagraphsDeleted(n); }
-    void notifySaved(const QString &p) { for (auto o : obs) o->onAutoSaved(p); }
-};
-
-class MessageObserver : public IObserver {
-    QWidget *parent = nullptr;
-public:
-    MessageObserver(QWidget *p = nullptr): parent(p) {}
-    void onParagraphsDeleted(int count) override {
-        QMessageBox::information(parent, "Абзаци видалено", QString("Видалено абзаців: %1").arg(count));
+    const QString durability = parser.isSet(durabilityOpt) || !qEnvironmentVariableIsSet("OPI_DURABILITY")
+                                   ? parser.value(durabilityOpt)
+                                   : qEnvironmentVariable("OPI_DURABILITY");
+    durable::Mode mode;
+    if (!durable::parseMode(durability, mode)) {
+        qCritical("unknown durability mode %s", qPrintable(durability));
+        return 1;
     }
-    void onAutoSaved(const QString &path) override {
-        QMessageBox::information(parent, "Автозбереження", QString("Файл оновлено: %1").arg(path));
+    durable::setMode(mode);
+    durable::GroupCommit::instance().setWindowMs(parser.value(groupMsOpt).toInt());
+
+    parsecache::cache().setCapacity(parser.value(cacheMbOpt).toLongLong() << 20);
+    parsecache::cache().setDirectory(parser.value(cacheDirOpt));
+
+    autosave::setByteBudget(parser.value(budgetOpt).toLongLong() << 20);
+
+    EditorWindow window;
+    const QString autosaveKind = parser.isSet(autosaveOpt) || !qEnvironmentVariableIsSet("OPI_AUTOSAVE_BACKEND")
+                                     ? parser.value(autosaveOpt)
+                                     : qEnvironmentVariable("OPI_AUTOSAVE_BACKEND");
+    if (autosaveKind != "auto") window.setAutosaveBackend(autosave::create(autosaveKind));
+
+    const int stallMs = parser.isSet(stallOpt) || !qEnvironmentVariableIsSet("OPI_STALL_MS")
+                            ? parser.value(stallOpt).toInt()
+                            : qEnvironmentVariableIntValue("OPI_STALL_MS");
+    watchdog::StallWatchdog stallWatchdog(&window, stallMs, parser.value(stallLogOpt));
+    stallWatchdog.start();
+
+    metrics::MetricsServer metricsServer;
+    if (parser.isSet(metricsOpt) && !metricsServer.listen(quint16(parser.value(metricsOpt).toUInt())))
+        qWarning("metrics: cannot listen on port %s: %s", qPrintable(parser.value(metricsOpt)), qPrintable(metricsServer.errorString()));
+
+    SessionRecorder recorder;
+    const QString recordPath = parser.isSet(recordOpt) ? parser.value(recordOpt) : qEnvironmentVariable("OPI_RECORD_TRACE");
+    if (!recordPath.isEmpty()) {
+        if (recorder.start(recordPath)) window.setRecorder(&recorder);
+        else QMessageBox::warning(&window, "Помилка", QString("Не вдалося записати сесію: %1").arg(recordPath));
     }
-};
 
-// ---------------- Utility: paragraph counting ----------------
-static int countParagraphs(const QString &text) {
-    QStringList paras;
-    QStringList lines = text.split('\n');
-    QString cur;
-    for (QString ln : lines) {
-        if (ln.trimmed().isEmpty()) {
-            if (!cur.isEmpty()) { paras << cur; cur.clear(); }
-        } else {
-            if (!cur.isEmpty()) cur += "\n";
-            cur += ln;
+    std::unique_ptr<TraceReplayer> replayer;
+    if (parser.isSet(replayOpt)) {
+        EditTrace trace;
+        if (!readTrace(parser.value(replayOpt), trace)) {
+            qCritical("cannot read trace %s", qPrintable(parser.value(replayOpt)));
+            return 1;
         }
+        replayer = std::make_unique<TraceReplayer>(&window, trace, parser.value(speedOpt) == "max", parser.value(fileOpt));
+        QTimer::singleShot(0, &window, [&]() { replayer->start(); });
     }
-    if (!cur.isEmpty()) paras << cur;
-    return paras.count();
-}
-
-int main(int argc, char *argv[]) {
-    QApplication app(argc, argv);
-    QWidget window;
-    window.setWindowTitle("Простий текстовий редактор (AbstractFactory + Observer)");
-    QVBoxLayout *layout = new QVBoxLayout(&window);
-
-    QMenuBar *menuBar = new QMenuBar();
-    QMenu *menuFile = menuBar->addMenu("File");
-    QAction *actOpen = menuFile->addAction("Відкрити...");
-    QAction *actSave = menuFile->addAction("Зберегти...");
-    menuFile->addSeparator();
-    QAction *actExit = menuFile->addAction("Вихід");
-
-    QTextEdit *txt = new QTextEdit();
-    txt->setAcceptRichText(false);
-    layout->setMenuBar(menuBar);
-    layout->addWidget(txt);
-
-    // State
-    QString currentPath;
-    std::unique_ptr<IFileFactory> currentFactory; // factory for current file extension
-
-    // Subject / observer
-    Subject subject;
-    MessageObserver msgObs(&window);
-    subject.add(&msgObs);
-
-    int lastParagraphCount = 0;
-    lastParagraphCount = countParagraphs(txt->toPlainText());
-
-    auto factoryForExtension = [](const QString &ext)->std::unique_ptr<IFileFactory> {
-        if (ext == "txt") return std::make_unique<TXTFactory>();
-        if (ext == "html" || ext == "htm") return std::make_unique<HTMLFactory>();
-        if (ext == "bin") return std::make_unique<BINFactory>();
-        return std::make_unique<TXTFactory>();
-    };
-
-    QObject::connect(actOpen, &QAction::triggered, [&]() {
-        QString fname = QFileDialog::getOpenFileName(&window, "Відкрити файл", "", "All Files (*.*)");
-        if (fname.isEmpty()) return;
-        QFileInfo fi(fname);
-        QString ext = fi.suffix().toLower();
-        currentFactory = factoryForExtension(ext);
-        auto loader = currentFactory->createLoader();
-        QString content = loader->load(fname);
-        txt->setPlainText(content);
-        currentPath = fname;
-        lastParagraphCount = countParagraphs(content);
-    });
-
-    QObject::connect(actSave, &QAction::triggered, [&]() {
-        if (currentPath.isEmpty()) {
-            QString fname = QFileDialog::getSaveFileName(&window, "Зберегти файл", "", "All Files (*.*)");
-            if (fname.isEmpty()) return;
-            currentPath = fname;
-            QFileInfo fi(fname);
-            currentFactory = factoryForExtension(fi.suffix().toLower());
-        }
-        if (!currentFactory) currentFactory = factoryForExtension(QFileInfo(currentPath).suffix().toLower());
-        auto saver = currentFactory->createSaver();
-        bool ok = saver->save(currentPath, txt->toPlainText());
-        if (!ok) QMessageBox::warning(&window, "Помилка", "Не вдалося зберегти файл.");
-        else subject.notifySaved(currentPath);
-    });
-
-    QObject::connect(actExit, &QAction::triggered, &app, &QApplication::quit);
-
-    QObject::connect(txt, &QTextEdit::textChanged, [&]() {
-        QString text = txt->toPlainText();
-        int curCount = countParagraphs(text);
-        if (curCount < lastParagraphCount) {
-            int deleted = lastParagraphCount - curCount;
-            subject.notifyDeleted(deleted);
-        } else if (curCount > lastParagraphCount) {
-            if (!currentPath.isEmpty()) {
-                if (!currentFactory) currentFactory = factoryForExtension(QFileInfo(currentPath).suffix().toLower());
-                auto saver = currentFactory->createSaver();
-                saver->save(currentPath, text);
-                subject.notifySaved(currentPath);
-            }
-        }
-        lastParagraphCount = curCount;
-    });
 
     window.resize(800, 600);
     window.show();
-    return app.exec();
+    const int rc = app.exec();
+    if (sampler) sampler->stop();
+    if (parser.isSet(traceOutOpt) && !tracing::exportChromeJson(parser.value(traceOutOpt)))
+        qWarning("cannot write trace %s", qPrintable(parser.value(traceOutOpt)));
+    return rc;
 }
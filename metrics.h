@@ -0,0 +1,361 @@
+#pragma once
+
+#include <QByteArray>
+#include <QFile>
+#include <QFormLayout>
+#include <QHostAddress>
+#include <QLabel>
+#include <QLocale>
+#include <QMap>
+#include <QString>
+#include <QStringList>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTimer>
+#include <QWidget>
+#include <QtGlobal>
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+#include "autosave.h"
+#include "cpu.h"
+#include "parsecache.h"
+#include "scheduler.h"
+
+#if defined(Q_OS_WIN)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#elif defined(Q_OS_LINUX)
+#include <unistd.h>
+#endif
+
+// ---------------- Live metrics ----------------
+// Process-wide counters updated by the editor, shown in the diagnostics panel
+// and served in Prometheus text format on localhost (`--metrics-port`).
+namespace metrics {
+
+struct LoadStat {
+    qint64 count = 0;
+    qint64 lastNs = 0;
+    qint64 totalNs = 0;
+};
+
+struct Snapshot {
+    qint64 handlerCount = 0;
+    qint64 handlerLastNs = 0;
+    qint64 handlerTotalNs = 0;
+    qint64 handlerP99Ns = 0; // over the last `window` keystrokes
+    qint64 autosaveCount = 0;
+    qint64 autosaveBytes = 0;
+    qint64 autosaveLastNs = 0;
+    qint64 autosaveTotalNs = 0;
+    autosave::QueueStats autosaveQueue;
+    QMap<QString, LoadStat> loads; // by format ("txt", "html", "bin")
+    qint64 documentChars = 0;
+    qint64 paragraphs = 0;
+    qint64 documentWords = -1; // as of the last open or save with statistics
+    parsecache::Stats parseCache;
+    sched::Stats scheduler;
+    qint64 residentBytes = -1;
+};
+
+// Resident set size, or -1 where it is not available.
+inline qint64 residentBytes() {
+#if defined(Q_OS_LINUX)
+    QFile f("/proc/self/statm");
+    if (!f.open(QIODevice::ReadOnly)) return -1;
+    const QList<QByteArray> fields = f.readAll().split(' ');
+    return fields.size() > 1 ? fields[1].toLongLong() * sysconf(_SC_PAGESIZE) : -1;
+#elif defined(Q_OS_WIN)
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) return -1;
+    return qint64(pmc.WorkingSetSize);
+#else
+    return -1;
+#endif
+}
+
+class Registry {
+public:
+    static constexpr size_t window = 1024;
+
+    static Registry &instance() {
+        static Registry r;
+        return r;
+    }
+
+    void keystroke(qint64 ns) {
+        std::lock_guard<std::mutex> lock(mu);
+        s.handlerLastNs = ns;
+        s.handlerTotalNs += ns;
+        if (recent.size() < window) recent.push_back(ns);
+        else recent[size_t(s.handlerCount) % window] = ns;
+        ++s.handlerCount;
+    }
+
+    void autosave(qint64 ns, qint64 bytes) {
+        std::lock_guard<std::mutex> lock(mu);
+        ++s.autosaveCount;
+        s.autosaveBytes += bytes;
+        s.autosaveLastNs = ns;
+        s.autosaveTotalNs += ns;
+    }
+
+    void load(const QString &format, qint64 ns) {
+        std::lock_guard<std::mutex> lock(mu);
+        LoadStat &l = s.loads[format];
+        ++l.count;
+        l.lastNs = ns;
+        l.totalNs += ns;
+    }
+
+    void document(qint64 chars, qint64 paragraphs) {
+        std::lock_guard<std::mutex> lock(mu);
+        s.documentChars = chars;
+        s.paragraphs = paragraphs;
+    }
+
+    void documentWords(qint64 words) {
+        std::lock_guard<std::mutex> lock(mu);
+        s.documentWords = words;
+    }
+
+    Snapshot snapshot() const {
+        Snapshot out;
+        std::vector<qint64> sorted;
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            out = s;
+            sorted = recent;
+        }
+        if (!sorted.empty()) {
+            const size_t k = (sorted.size() * 99 + 99) / 100 - 1;
+            std::nth_element(sorted.begin(), sorted.begin() + qsizetype(k), sorted.end());
+            out.handlerP99Ns = sorted[k];
+        }
+        out.autosaveQueue = autosave::queueStats();
+        out.parseCache = parsecache::cache().stats();
+        out.scheduler = sched::scheduler().stats();
+        out.residentBytes = residentBytes();
+        return out;
+    }
+
+private:
+    mutable std::mutex mu;
+    Snapshot s;
+    std::vector<qint64> recent;
+};
+
+inline Registry &registry() { return Registry::instance(); }
+
+// Prometheus text exposition format 0.0.4.
+inline QByteArray prometheusText(const Snapshot &m) {
+    QByteArray out;
+    auto seconds = [](qint64 ns) { return QByteArray::number(double(ns) / 1e9, 'g', 9); };
+    auto metric = [&](const char *name, const char *type, const char *help) {
+        out += QByteArray("# HELP ") + name + ' ' + help + "\n# TYPE " + name + ' ' + type + '\n';
+    };
+
+    metric("opi_keystroke_handler_seconds", "summary", "Time spent in the textChanged handler.");
+    out += "opi_keystroke_handler_seconds{quantile=\"0.99\"} " + seconds(m.handlerP99Ns) + '\n';
+    out += "opi_keystroke_handler_seconds_sum " + seconds(m.handlerTotalNs) + '\n';
+    out += "opi_keystroke_handler_seconds_count " + QByteArray::number(m.handlerCount) + '\n';
+    metric("opi_keystroke_handler_last_seconds", "gauge", "Duration of the most recent textChanged handler.");
+    out += "opi_keystroke_handler_last_seconds " + seconds(m.handlerLastNs) + '\n';
+
+    metric("opi_autosaves_total", "counter", "Autosaves performed.");
+    out += "opi_autosaves_total " + QByteArray::number(m.autosaveCount) + '\n';
+    metric("opi_autosave_bytes_total", "counter", "Bytes written by autosaves.");
+    out += "opi_autosave_bytes_total " + QByteArray::number(m.autosaveBytes) + '\n';
+    metric("opi_autosave_seconds_total", "counter", "Time spent autosaving.");
+    out += "opi_autosave_seconds_total " + seconds(m.autosaveTotalNs) + '\n';
+    metric("opi_autosave_last_seconds", "gauge", "Duration of the most recent autosave.");
+    out += "opi_autosave_last_seconds " + seconds(m.autosaveLastNs) + '\n';
+    metric("opi_autosave_queue_depth", "gauge", "Autosave snapshots being written or waiting.");
+    out += "opi_autosave_queue_depth " + QByteArray::number(m.autosaveQueue.depth) + '\n';
+    metric("opi_autosave_queue_bytes", "gauge", "Memory held by those snapshots.");
+    out += "opi_autosave_queue_bytes " + QByteArray::number(m.autosaveQueue.bytes) + '\n';
+    metric("opi_autosave_queue_budget_bytes", "gauge", "Byte budget for waiting autosave snapshots.");
+    out += "opi_autosave_queue_budget_bytes " + QByteArray::number(m.autosaveQueue.budget) + '\n';
+    metric("opi_autosave_dropped_total", "counter", "Snapshots replaced by a newer one or over the byte budget.");
+    out += "opi_autosave_dropped_total " + QByteArray::number(m.autosaveQueue.dropped) + '\n';
+    metric("opi_autosave_write_seconds", "histogram", "Autosave latency from submit to completion, queueing included.");
+    qint64 cumulative = 0;
+    for (int b = 0; b < autosave::latencyBuckets; ++b) {
+        cumulative += m.autosaveQueue.latency[b];
+        const QByteArray le = b < autosave::latencyBuckets - 1 ? QByteArray::number(double(autosave::latencyBoundsMs[b]) / 1000, 'g', 6)
+                                                              : QByteArray("+Inf");
+        out += "opi_autosave_write_seconds_bucket{le=\"" + le + "\"} " + QByteArray::number(cumulative) + '\n';
+    }
+    out += "opi_autosave_write_seconds_sum " + seconds(m.autosaveQueue.latencySumNs) + '\n';
+    out += "opi_autosave_write_seconds_count " + QByteArray::number(m.autosaveQueue.latencyCount) + '\n';
+
+    metric("opi_loads_total", "counter", "Files opened, by format.");
+    for (auto it = m.loads.cbegin(); it != m.loads.cend(); ++it)
+        out += "opi_loads_total{format=\"" + it.key().toUtf8() + "\"} " + QByteArray::number(it->count) + '\n';
+    metric("opi_load_last_seconds", "gauge", "Duration of the most recent open, by format.");
+    for (auto it = m.loads.cbegin(); it != m.loads.cend(); ++it)
+        out += "opi_load_last_seconds{format=\"" + it.key().toUtf8() + "\"} " + seconds(it->lastNs) + '\n';
+
+    metric("opi_document_chars", "gauge", "Characters in the open document.");
+    out += "opi_document_chars " + QByteArray::number(m.documentChars) + '\n';
+    metric("opi_document_paragraphs", "gauge", "Paragraphs in the open document.");
+    out += "opi_document_paragraphs " + QByteArray::number(m.paragraphs) + '\n';
+    if (m.documentWords >= 0) {
+        metric("opi_document_words", "gauge", "Words in the open document at its last open or save.");
+        out += "opi_document_words " + QByteArray::number(m.documentWords) + '\n';
+    }
+    metric("opi_parse_cache_hits_total", "counter", "Opens served from the parse cache.");
+    out += "opi_parse_cache_hits_total " + QByteArray::number(m.parseCache.hits) + '\n';
+    metric("opi_parse_cache_misses_total", "counter", "Cacheable opens that had to convert the file.");
+    out += "opi_parse_cache_misses_total " + QByteArray::number(m.parseCache.misses) + '\n';
+    metric("opi_parse_cache_evictions_total", "counter", "Parse cache entries evicted to stay under the size cap.");
+    out += "opi_parse_cache_evictions_total " + QByteArray::number(m.parseCache.evictions) + '\n';
+    metric("opi_scheduler_workers", "gauge", "Worker threads of the background scheduler.");
+    out += "opi_scheduler_workers " + QByteArray::number(m.scheduler.workers) + '\n';
+    metric("opi_scheduler_queue_depth", "gauge", "Background tasks waiting to run, by priority.");
+    for (int p = 0; p < sched::priorities; ++p)
+        out += QByteArray("opi_scheduler_queue_depth{priority=\"") + sched::priorityName(sched::Priority(p)) + "\"} "
+               + QByteArray::number(m.scheduler.queued[p]) + '\n';
+    metric("opi_scheduler_tasks_total", "counter", "Background tasks run, by priority.");
+    for (int p = 0; p < sched::priorities; ++p)
+        out += QByteArray("opi_scheduler_tasks_total{priority=\"") + sched::priorityName(sched::Priority(p)) + "\"} "
+               + QByteArray::number(m.scheduler.executed[p]) + '\n';
+    metric("opi_scheduler_steals_total", "counter", "Tasks a worker took from another worker's queue.");
+    out += "opi_scheduler_steals_total " + QByteArray::number(m.scheduler.steals) + '\n';
+    metric("opi_cpu_level_info", "gauge", "Instruction set used by the text kernels, and the best one the CPU has.");
+    out += QByteArray("opi_cpu_level_info{level=\"") + cpu::levelName(cpu::level()) + "\",detected=\""
+           + cpu::levelName(cpu::detected()) + "\"} 1\n";
+    if (m.residentBytes >= 0) {
+        metric("opi_resident_memory_bytes", "gauge", "Resident set size of the editor process.");
+        out += "opi_resident_memory_bytes " + QByteArray::number(m.residentBytes) + '\n';
+    }
+    return out;
+}
+
+// Minimal HTTP/1.0 responder for GET /metrics, bound to localhost only.
+class MetricsServer {
+public:
+    bool listen(quint16 port) {
+        QObject::connect(&server, &QTcpServer::newConnection, [this]() {
+            while (QTcpSocket *sock = server.nextPendingConnection()) {
+                QObject::connect(sock, &QTcpSocket::disconnected, sock, &QObject::deleteLater);
+                QObject::connect(sock, &QTcpSocket::readyRead, sock, [sock]() { respond(sock); });
+            }
+        });
+        return server.listen(QHostAddress::LocalHost, port);
+    }
+
+    QString errorString() const { return server.errorString(); }
+
+private:
+    QTcpServer server;
+
+    static void respond(QTcpSocket *sock) {
+        if (sock->property("answered").toBool()) return;
+        if (sock->bytesAvailable() > 8192) { // not a scrape
+            sock->abort();
+            return;
+        }
+        if (!sock->canReadLine()) return;
+        const QList<QByteArray> request = sock->readLine().trimmed().split(' ');
+        sock->setProperty("answered", true);
+        QByteArray status = "200 OK", body;
+        if (request.size() < 2 || request[0] != "GET") {
+            status = "405 Method Not Allowed";
+        } else if (request[1] != "/metrics" && request[1] != "/") {
+            status = "404 Not Found";
+        } else {
+            body = prometheusText(registry().snapshot());
+        }
+        sock->write("HTTP/1.0 " + status + "\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\nContent-Length: "
+                    + QByteArray::number(body.size()) + "\r\nConnection: close\r\n\r\n" + body);
+        sock->disconnectFromHost();
+    }
+};
+
+// Diagnostics window with the same counters, refreshed twice a second.
+class MetricsPanel : public QWidget {
+    QLabel *handler = new QLabel;
+    QLabel *autosave = new QLabel;
+    QLabel *loads = new QLabel;
+    QLabel *document = new QLabel;
+    QLabel *parseCache = new QLabel;
+    QLabel *scheduler = new QLabel;
+    QLabel *cpuLevel = new QLabel;
+    QLabel *memory = new QLabel;
+    QTimer timer;
+
+public:
+    explicit MetricsPanel(QWidget *parent = nullptr) : QWidget(parent, Qt::Window) {
+        setWindowTitle("Метрики продуктивності");
+        QFormLayout *form = new QFormLayout(this);
+        form->addRow("Обробник натискань:", handler);
+        form->addRow("Автозбереження:", autosave);
+        form->addRow("Завантаження:", loads);
+        form->addRow("Документ:", document);
+        form->addRow("Кеш розбору:", parseCache);
+        form->addRow("Планувальник:", scheduler);
+        form->addRow("Набір інструкцій:", cpuLevel);
+        form->addRow("Пам'ять:", memory);
+        connect(&timer, &QTimer::timeout, this, [this]() { refresh(); });
+        timer.start(500);
+        refresh();
+    }
+
+protected:
+    void showEvent(QShowEvent *e) override {
+        QWidget::showEvent(e);
+        refresh();
+    }
+
+private:
+    static QString ms(qint64 ns) { return QString::number(double(ns) / 1e6, 'f', 2) + " мс"; }
+
+    void refresh() {
+        if (!isVisible()) return;
+        const Snapshot m = registry().snapshot();
+        const QLocale loc;
+        handler->setText(QString("останній %1, p99 %2 (%3 викликів)").arg(ms(m.handlerLastNs), ms(m.handlerP99Ns)).arg(m.handlerCount));
+        autosave->setText(QString("%1 разів, %2 записано, останнє %3; у черзі %4 (%5), відкинуто %6")
+                              .arg(m.autosaveCount)
+                              .arg(loc.formattedDataSize(m.autosaveBytes), ms(m.autosaveLastNs))
+                              .arg(m.autosaveQueue.depth)
+                              .arg(loc.formattedDataSize(m.autosaveQueue.bytes))
+                              .arg(m.autosaveQueue.dropped));
+        QStringList perFormat;
+        for (auto it = m.loads.cbegin(); it != m.loads.cend(); ++it)
+            perFormat << QString("%1: %2").arg(it.key().toUpper(), ms(it->lastNs));
+        loads->setText(perFormat.isEmpty() ? QString("-") : perFormat.join(", "));
+        QString doc = QString("%1 символів, %2 абзаців").arg(m.documentChars).arg(m.paragraphs);
+        if (m.documentWords >= 0) doc += QString(", %1 слів").arg(m.documentWords);
+        document->setText(doc);
+        const qint64 lookups = m.parseCache.hits + m.parseCache.misses;
+        parseCache->setText(lookups ? QString("%1 влучань, %2 промахів (%3%), витіснено %4")
+                                          .arg(m.parseCache.hits)
+                                          .arg(m.parseCache.misses)
+                                          .arg(100 * m.parseCache.hits / lookups)
+                                          .arg(m.parseCache.evictions)
+                                    : QString("-"));
+        qint64 queued = 0, executed = 0;
+        for (int p = 0; p < sched::priorities; ++p) {
+            queued += m.scheduler.queued[p];
+            executed += m.scheduler.executed[p];
+        }
+        scheduler->setText(QString("%1 потоків, у черзі %2, виконано %3, викрадено %4")
+                               .arg(m.scheduler.workers)
+                               .arg(queued)
+                               .arg(executed)
+                               .arg(m.scheduler.steals));
+        cpuLevel->setText(cpu::level() == cpu::detected()
+                              ? QString(cpu::levelName(cpu::level()))
+                              : QString("%1 (процесор підтримує %2)").arg(cpu::levelName(cpu::level()), cpu::levelName(cpu::detected())));
+        memory->setText(m.residentBytes >= 0 ? loc.formattedDataSize(m.residentBytes) : QString("-"));
+    }
+};
+
+} // namespace metrics
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <QList>
+#include <QMessageBox>
+#include <QString>
+#include <QWidget>
+
+#include "tracing.h"
+
+// ---------------- Observer ----------------
+class IObserver {
+public:
+    virtual ~IObserver() = default;
+    virtual void onParagraphsDeleted(int count) = 0;
+    virtual void onAutoSaved(const QString &path) = 0;
+};
+
+class Subject {
+    QList<IObserver*> obs;
+public:
+    void add(IObserver* o) { if (o && !obs.contains(o)) obs.append(o); }
+    void remove(IObserver* o) { obs.removeAll(o); }
+
+    void notifyDeleted(int n) {
+        OPI_TRACE_SCOPE("Subject::notifyDeleted");
+        for (auto o : obs) o->onParagraphsDeleted(n);
+    }
+    void notifySaved(const QString &p) {
+        OPI_TRACE_SCOPE("Subject::notifySaved");
+        for (auto o : obs) o->onAutoSaved(p);
+    }
+};
+
+class MessageObserver : public IObserver {
+    QWidget *parent = nullptr;
+public:
+    MessageObserver(QWidget *p = nullptr): parent(p) {}
+    void onParagraphsDeleted(int count) override {
+        QMessageBox::information(parent, "Абзаци видалено", QString("Видалено абзаців: %1").arg(count));
+    }
+    void onAutoSaved(const QString &path) override {
+        QMessageBox::information(parent, "Автозбереження", QString("Файл оновлено: %1").arg(path));
+    }
+};
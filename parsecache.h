@@ -0,0 +1,220 @@
+#pragma once
+
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QString>
+#include <QtGlobal>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include "durable.h"
+#include "textcodec.h"
+#include "tracing.h"
+
+// ---------------- Parse cache ----------------
+// Converting a large HTML file to plain text is far slower than reading it, so
+// the converted text is kept on disk, keyed by the source path and validated
+// against its size, mtime and a hash of its bytes. An entry holds the text
+// (zlib-compressed UTF-8), the paragraph index and the TextFormat the loader
+// reported; it is memory-mapped and decompressed straight from the mapping on
+// a hit. The least recently used entries are evicted past the size cap.
+//
+// Disabled until a directory is set (main.cpp uses the platform cache dir).
+namespace parsecache {
+
+struct Entry {
+    QString text;
+    TextFormat format;
+    std::vector<qint64> paragraphs; // start offsets, see paragraphStarts()
+};
+
+struct Stats {
+    qint64 hits = 0;
+    qint64 misses = 0;
+    qint64 evictions = 0;
+};
+
+// 64-bit multiply-xorshift over 8-byte words; only has to tell versions of
+// one file apart, quickly.
+inline quint64 contentHash(const char *p, qsizetype n) {
+    const quint64 k = Q_UINT64_C(0x9E3779B97F4A7C15);
+    quint64 h = k ^ quint64(n);
+    qsizetype i = 0;
+    for (; i + 8 <= n; i += 8) {
+        quint64 w;
+        std::memcpy(&w, p + i, sizeof(w));
+        h = (h ^ w) * k;
+        h ^= h >> 29;
+    }
+    quint64 tail = 0;
+    std::memcpy(&tail, p + i, size_t(n - i));
+    h = (h ^ tail) * k;
+    return h ^ (h >> 32);
+}
+
+class Cache {
+public:
+    // Files smaller than this are converted faster than an entry is read.
+    static constexpr qint64 minSourceSize = 64 * 1024;
+
+    static Cache &instance() {
+        static Cache c;
+        return c;
+    }
+
+    // An empty dir disables the cache.
+    void setDirectory(const QString &dir) {
+        std::lock_guard<std::mutex> lock(mu);
+        root = dir;
+        if (!root.isEmpty()) QDir().mkpath(root);
+    }
+    void setCapacity(qint64 bytes) { capacity = bytes; }
+    bool enabled() const {
+        std::lock_guard<std::mutex> lock(mu);
+        return !root.isEmpty() && capacity > 0;
+    }
+
+    Stats stats() const {
+        Stats s;
+        s.hits = hits;
+        s.misses = misses;
+        s.evictions = evictions;
+        return s;
+    }
+
+    // raw: the bytes just read from path.
+    bool lookup(const QString &path, const QByteArray &raw, Entry &out) {
+        if (raw.size() < minSourceSize || !enabled()) return false;
+        OPI_TRACE_SCOPE("parsecache::lookup");
+        if (!read(path, raw, out)) {
+            ++misses;
+            return false;
+        }
+        ++hits;
+        return true;
+    }
+
+    void store(const QString &path, const QByteArray &raw, const Entry &e) {
+        if (raw.size() < minSourceSize || !enabled()) return;
+        OPI_TRACE_SCOPE("parsecache::store");
+        const QFileInfo src(path);
+        const QByteArray key = src.absoluteFilePath().toUtf8();
+        const QByteArray text = qCompress(e.text.toUtf8(), 1);
+
+        Header h;
+        std::memcpy(h.magic, fileMagic, sizeof(h.magic));
+        h.sourceSize = quint64(raw.size());
+        h.sourceMtimeMs = src.lastModified().toMSecsSinceEpoch();
+        h.sourceHash = contentHash(raw.constData(), raw.size());
+        h.encoding = quint8(e.format.encoding);
+        h.newline = quint8(e.format.newline);
+        h.bom = e.format.bom;
+        h.keyBytes = quint32(key.size());
+        h.paragraphs = quint64(e.paragraphs.size());
+        h.textBytes = quint64(text.size());
+
+        durable::AtomicFile f(entryPath(key));
+        if (!f.open()) return;
+        QIODevice *d = f.device();
+        const bool ok = d->write(reinterpret_cast<const char *>(&h), sizeof(h)) == qint64(sizeof(h)) && d->write(key) == key.size()
+                        && d->write(reinterpret_cast<const char *>(e.paragraphs.data()), qint64(e.paragraphs.size() * sizeof(qint64)))
+                               == qint64(e.paragraphs.size() * sizeof(qint64))
+                        && d->write(text) == text.size();
+        if (ok && f.commit()) evict();
+    }
+
+private:
+    static constexpr char fileMagic[8] = {'O', 'P', 'I', 'P', 'C', '0', '0', '1'};
+
+    struct Header {
+        char magic[8];
+        quint64 sourceSize;
+        qint64 sourceMtimeMs;
+        quint64 sourceHash;
+        quint8 encoding, newline, bom, reserved;
+        quint32 keyBytes;   // followed by the absolute source path (UTF-8)
+        quint64 paragraphs; // then this many qint64 offsets
+        quint64 textBytes;  // then the qCompress()ed UTF-8 text
+    };
+
+    mutable std::mutex mu;
+    QString root;
+    std::atomic<qint64> capacity{qint64(256) << 20};
+    std::atomic<qint64> hits{0}, misses{0}, evictions{0};
+
+    Cache() = default;
+
+    QString entryPath(const QByteArray &key) const {
+        std::lock_guard<std::mutex> lock(mu);
+        return root + '/' + QCryptographicHash::hash(key, QCryptographicHash::Sha1).toHex() + ".pc";
+    }
+
+    bool read(const QString &path, const QByteArray &raw, Entry &out) {
+        const QFileInfo src(path);
+        const QByteArray key = src.absoluteFilePath().toUtf8();
+        QFile f(entryPath(key));
+        if (!f.open(QIODevice::ReadOnly) || f.size() < qint64(sizeof(Header))) return false;
+        uchar *map = f.map(0, f.size());
+        if (!map) return false;
+        const qint64 size = f.size();
+        bool ok = false;
+        Header h;
+        std::memcpy(&h, map, sizeof(h));
+        const qint64 indexAt = qint64(sizeof(h)) + h.keyBytes;
+        const qint64 textAt = indexAt + qint64(h.paragraphs * sizeof(qint64));
+        if (std::memcmp(h.magic, fileMagic, sizeof(fileMagic)) == 0 && h.keyBytes == quint32(key.size()) && h.paragraphs < quint64(size)
+            && h.textBytes <= quint64(size) && textAt + qint64(h.textBytes) == size
+            && std::memcmp(map + sizeof(h), key.constData(), size_t(key.size())) == 0 && h.sourceSize == quint64(raw.size())
+            && h.sourceMtimeMs == src.lastModified().toMSecsSinceEpoch() && h.encoding <= quint8(Encoding::Koi8u)
+            && h.sourceHash == contentHash(raw.constData(), raw.size())) {
+            const QByteArray text = qUncompress(map + textAt, qsizetype(h.textBytes));
+            if (!text.isEmpty() || h.textBytes == 0) {
+                out.text = QString::fromUtf8(text);
+                out.paragraphs.resize(size_t(h.paragraphs));
+                std::memcpy(out.paragraphs.data(), map + indexAt, size_t(h.paragraphs * sizeof(qint64)));
+                out.format.encoding = Encoding(h.encoding);
+                out.format.newline = Newline(h.newline);
+                out.format.bom = h.bom;
+                ok = true;
+            }
+        }
+        f.unmap(map);
+        f.close();
+        // Recency for LRU eviction is the entry's mtime.
+        if (ok && f.open(QIODevice::ReadWrite)) f.setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+        return ok;
+    }
+
+    // Drops the least recently used entries until the cache fits its cap.
+    void evict() {
+        QString dir;
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            dir = root;
+        }
+        QFileInfoList entries = QDir(dir).entryInfoList({"*.pc"}, QDir::Files);
+        qint64 total = 0;
+        for (const QFileInfo &e : entries) total += e.size();
+        if (total <= capacity) return;
+        std::sort(entries.begin(), entries.end(),
+                  [](const QFileInfo &a, const QFileInfo &b) { return a.lastModified() < b.lastModified(); });
+        for (const QFileInfo &e : entries) {
+            if (total <= capacity) break;
+            if (QFile::remove(e.absoluteFilePath())) {
+                total -= e.size();
+                ++evictions;
+            }
+        }
+    }
+};
+
+inline Cache &cache() { return Cache::instance(); }
+
+} // namespace parsecache
@@ -0,0 +1,285 @@
+#pragma once
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QMap>
+#include <QObject>
+#include <QString>
+#include <QTimer>
+#include <QtGlobal>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#if defined(Q_OS_LINUX)
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <elf.h>
+#include <execinfo.h>
+#include <link.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#endif
+
+// ---------------- Sampling profiler ----------------
+// `--profile out.folded`: SIGPROF fires every 1/hz seconds of process CPU
+// time (ITIMER_PROF), on whichever thread is running, so the GUI thread and
+// any workers are sampled in proportion to the CPU they use. The handler
+// only copies a backtrace into a preallocated ring; a GUI timer drains the
+// ring into per-stack counts, and stop() symbolises them (the binary's own
+// .symtab when it is not stripped, dladdr otherwise) and writes folded
+// stacks for flamegraph.pl / speedscope / Perfetto. Linux only.
+namespace profiler {
+
+#if defined(Q_OS_LINUX)
+namespace detail {
+
+constexpr int maxDepth = 48;
+constexpr size_t ringSize = 8192;
+
+struct Sample {
+    std::atomic<size_t> seq{0}; // index + 1 once the slot is fully written
+    pid_t tid = 0;
+    int depth = 0;
+    void *pc[maxDepth];
+};
+
+inline Sample *ring = nullptr;
+inline std::atomic<size_t> nextSlot{0};
+inline std::atomic<qint64> handlerNs{0};
+
+inline qint64 monotonicNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return qint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+inline void onProfSignal(int) {
+    const int savedErrno = errno;
+    const qint64 t0 = monotonicNs();
+    const size_t idx = nextSlot.fetch_add(1, std::memory_order_relaxed);
+    Sample &s = ring[idx % ringSize];
+    s.tid = pid_t(syscall(SYS_gettid));
+    s.depth = backtrace(s.pc, maxDepth);
+    s.seq.store(idx + 1, std::memory_order_release);
+    handlerNs.fetch_add(monotonicNs() - t0, std::memory_order_relaxed);
+    errno = savedErrno;
+}
+
+// Function symbols of the running executable from its own ELF .symtab.
+class ExeSymbols {
+    struct Sym {
+        quintptr start;
+        quintptr size;
+        QByteArray name;
+        bool operator<(const Sym &o) const { return start < o.start; }
+    };
+    std::vector<Sym> syms;
+    quintptr bias = 0;
+
+    static int firstObject(dl_phdr_info *info, size_t, void *data) {
+        *static_cast<quintptr *>(data) = quintptr(info->dlpi_addr); // the main program comes first
+        return 1;
+    }
+
+public:
+    bool load() {
+        QFile exe("/proc/self/exe");
+        if (!exe.open(QIODevice::ReadOnly)) return false;
+        const qint64 size = exe.size();
+        const uchar *base = exe.map(0, size);
+        if (!base || size < qint64(sizeof(Elf64_Ehdr))) return false;
+        const auto *eh = reinterpret_cast<const Elf64_Ehdr *>(base);
+        if (std::memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 || eh->e_ident[EI_CLASS] != ELFCLASS64) return false;
+        if (eh->e_shoff + quint64(eh->e_shnum) * sizeof(Elf64_Shdr) > quint64(size)) return false;
+        const auto *sh = reinterpret_cast<const Elf64_Shdr *>(base + eh->e_shoff);
+        for (int i = 0; i < eh->e_shnum; ++i) {
+            if (sh[i].sh_type != SHT_SYMTAB || sh[i].sh_link >= eh->e_shnum) continue;
+            const Elf64_Shdr &strs = sh[sh[i].sh_link];
+            if (sh[i].sh_offset + sh[i].sh_size > quint64(size) || strs.sh_offset + strs.sh_size > quint64(size)) continue;
+            const auto *sym = reinterpret_cast<const Elf64_Sym *>(base + sh[i].sh_offset);
+            const char *names = reinterpret_cast<const char *>(base + strs.sh_offset);
+            for (size_t j = 0; j < sh[i].sh_size / sizeof(Elf64_Sym); ++j) {
+                if (ELF64_ST_TYPE(sym[j].st_info) != STT_FUNC || !sym[j].st_value || sym[j].st_name >= strs.sh_size) continue;
+                syms.push_back({quintptr(sym[j].st_value), quintptr(sym[j].st_size), QByteArray(names + sym[j].st_name)});
+            }
+        }
+        std::sort(syms.begin(), syms.end());
+        if (eh->e_type == ET_DYN) dl_iterate_phdr(firstObject, &bias);
+        return !syms.empty();
+    }
+
+    // Mangled name, or empty if pc is not inside a known function.
+    QByteArray lookup(quintptr pc) const {
+        const quintptr rel = pc - bias;
+        auto it = std::upper_bound(syms.begin(), syms.end(), Sym{rel, 0, {}});
+        if (it == syms.begin()) return {};
+        --it;
+        return rel < it->start + qMax<quintptr>(it->size, 1) ? it->name : QByteArray();
+    }
+};
+
+inline QByteArray demangle(const char *name) {
+    int status = 0;
+    char *d = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+    if (status != 0 || !d) return QByteArray(name);
+    QByteArray out(d);
+    std::free(d);
+    return out;
+}
+
+} // namespace detail
+#endif
+
+class SamplingProfiler {
+public:
+    SamplingProfiler(const QString &outPath, int hz) : path(outPath), rate(qBound(1, hz, 10000)) {}
+    ~SamplingProfiler() { stop(); }
+
+    bool start() {
+#if defined(Q_OS_LINUX)
+        if (active) return true;
+        if (!detail::ring) detail::ring = new detail::Sample[detail::ringSize];
+        void *warm[1];
+        backtrace(warm, 1); // loads libgcc before the first signal
+        struct sigaction sa = {};
+        sa.sa_handler = detail::onProfSignal;
+        sa.sa_flags = SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        if (sigaction(SIGPROF, &sa, nullptr) != 0) return false;
+        itimerval it = {};
+        const long us = 1000000 / rate;
+        it.it_interval.tv_sec = us / 1000000;
+        it.it_interval.tv_usec = us % 1000000;
+        it.it_value = it.it_interval;
+        if (setitimer(ITIMER_PROF, &it, nullptr) != 0) return false;
+        drainTimer = std::make_unique<QTimer>();
+        QObject::connect(drainTimer.get(), &QTimer::timeout, [this]() { drain(); });
+        drainTimer->start(500);
+        active = true;
+        return true;
+#else
+        qWarning("profiler: --profile is only supported on Linux");
+        return false;
+#endif
+    }
+
+    // Stops sampling and writes the folded stacks.
+    bool stop() {
+#if defined(Q_OS_LINUX)
+        if (!active) return false;
+        active = false;
+        itimerval off = {};
+        setitimer(ITIMER_PROF, &off, nullptr);
+        signal(SIGPROF, SIG_IGN);
+        drainTimer.reset();
+        drain();
+        return write();
+#else
+        return false;
+#endif
+    }
+
+private:
+    QString path;
+    int rate;
+    bool active = false;
+    std::unique_ptr<QTimer> drainTimer;
+    size_t readPos = 0;
+    qint64 taken = 0;
+    qint64 dropped = 0;
+    // Key: tid, then raw return addresses (leaf first).
+    QHash<QByteArray, qint64> stacks;
+    QHash<qint64, QByteArray> threadNames;
+
+#if defined(Q_OS_LINUX)
+    void drain() {
+        const size_t end = detail::nextSlot.load(std::memory_order_acquire);
+        if (end - readPos > detail::ringSize) { // the handler lapped us
+            dropped += qint64(end - readPos - detail::ringSize);
+            readPos = end - detail::ringSize;
+        }
+        for (; readPos < end; ++readPos) {
+            detail::Sample &s = detail::ring[readPos % detail::ringSize];
+            if (s.seq.load(std::memory_order_acquire) != readPos + 1) break; // still being written
+            // Frames 0 and 1 are the handler and the signal trampoline.
+            const int first = qMin(2, s.depth);
+            QByteArray key(reinterpret_cast<const char *>(&s.tid), sizeof(s.tid));
+            key.append(reinterpret_cast<const char *>(s.pc + first), qsizetype(s.depth - first) * qsizetype(sizeof(void *)));
+            ++stacks[key];
+            ++taken;
+            if (!threadNames.contains(s.tid)) threadNames.insert(s.tid, threadName(s.tid));
+        }
+    }
+
+    static QByteArray threadName(pid_t tid) {
+        if (tid == getpid()) return "gui";
+        QFile comm(QString("/proc/self/task/%1/comm").arg(tid));
+        QByteArray name = comm.open(QIODevice::ReadOnly) ? comm.readAll().trimmed() : QByteArray();
+        return (name.isEmpty() ? QByteArray("thread") : name) + '-' + QByteArray::number(tid);
+    }
+
+    QByteArray symbolize(void *pc, bool isReturnAddress, const detail::ExeSymbols &exe, QHash<void *, QByteArray> &cache) {
+        auto it = cache.find(pc);
+        if (it != cache.end()) return *it;
+        // Return addresses point after the call; step back into it.
+        const quintptr addr = quintptr(pc) - (isReturnAddress ? 1 : 0);
+        QByteArray name = exe.lookup(addr);
+        Dl_info info;
+        if (name.isEmpty() && dladdr(reinterpret_cast<void *>(addr), &info)) {
+            if (info.dli_sname) name = info.dli_sname;
+            else if (info.dli_fname) name = QByteArray(info.dli_fname).split('/').last() + "+0x"
+                                            + QByteArray::number(qulonglong(addr - quintptr(info.dli_fbase)), 16);
+        }
+        name = name.isEmpty() ? "0x" + QByteArray::number(qulonglong(addr), 16) : detail::demangle(name.constData());
+        name.replace(';', ':'); // ';' separates frames in the folded format
+        cache.insert(pc, name);
+        return name;
+    }
+
+    bool write() {
+        detail::ExeSymbols exe;
+        exe.load();
+        QHash<void *, QByteArray> cache;
+        QMap<QByteArray, qint64> folded; // sorted output
+        for (auto it = stacks.cbegin(); it != stacks.cend(); ++it) {
+            const QByteArray &key = it.key();
+            pid_t tid;
+            std::memcpy(&tid, key.constData(), sizeof(tid));
+            const int n = int((key.size() - qsizetype(sizeof(tid))) / qsizetype(sizeof(void *)));
+            QByteArray line = threadNames.value(tid);
+            for (int i = n - 1; i >= 0; --i) { // root first
+                void *pc;
+                std::memcpy(&pc, key.constData() + sizeof(tid) + size_t(i) * sizeof(void *), sizeof(pc));
+                line += ';' + symbolize(pc, i > 0, exe, cache);
+            }
+            folded[line] += it.value();
+        }
+        QFile f(path);
+        if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            qWarning("profiler: cannot write %s", qPrintable(path));
+            return false;
+        }
+        for (auto it = folded.cbegin(); it != folded.cend(); ++it) f.write(it.key() + ' ' + QByteArray::number(it.value()) + '\n');
+
+        rusage ru;
+        getrusage(RUSAGE_SELF, &ru);
+        const double cpuNs = (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e9 + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1e3;
+        const qint64 spent = detail::handlerNs.load(std::memory_order_relaxed);
+        qInfo("profiler: %lld samples at %d Hz (%lld dropped), handler overhead %.2f%% of CPU time -> %s",
+              taken, rate, dropped, cpuNs > 0 ? 100.0 * double(spent) / cpuNs : 0.0, qPrintable(path));
+        return true;
+    }
+#endif
+};
+
+} // namespace profiler
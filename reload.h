@@ -0,0 +1,128 @@
+#pragma once
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+#include <QTextCursor>
+#include <QTextDocument>
+#include <QtGlobal>
+
+#include "diff.h"
+#include "parsecache.h"
+#include "textcodec.h"
+#include "tracing.h"
+
+// ---------------- External changes ----------------
+// What the editor last knew about its file on disk, so that a change
+// notification can be classified: our own write (same stamp), growth past
+// an unchanged tail (append: only the new bytes are read, like tail -f), or
+// anything else (reload and patch the changed paragraphs in place, see diff.h).
+namespace reload {
+
+constexpr qint64 tailBytes = 4096;
+
+struct DiskStamp {
+    qint64 size = -1;
+    quint64 tailHash = 0; // of the last min(size, tailBytes) bytes
+    bool operator==(const DiskStamp &o) const { return size == o.size && tailHash == o.tailHash; }
+    bool operator!=(const DiskStamp &o) const { return !(*this == o); }
+};
+
+inline quint64 hashTail(const char *end, qint64 size) {
+    const qint64 n = qMin(size, tailBytes);
+    return parsecache::contentHash(end - n, qsizetype(n));
+}
+
+inline DiskStamp stamp(const QString &path) {
+    DiskStamp s;
+    QFile f(path);
+    if (!f.open(QIODevice::ReadOnly)) return s;
+    s.size = f.size();
+    const qint64 n = qMin(s.size, tailBytes);
+    if (!f.seek(s.size - n)) return DiskStamp();
+    const QByteArray tail = f.read(n);
+    if (tail.size() != n) return DiskStamp();
+    s.tailHash = hashTail(tail.constData() + n, s.size);
+    return s;
+}
+
+// Bytes at the end of an append that cannot be decoded yet: a partial UTF-8
+// sequence or UTF-16 unit, or a CR that may be the first half of a CRLF.
+inline qsizetype incompleteTail(const QByteArray &bytes, Encoding e) {
+    const uchar *p = reinterpret_cast<const uchar *>(bytes.constData());
+    const qsizetype n = bytes.size();
+    qsizetype keep = 0;
+    switch (e) {
+    case Encoding::Utf8:
+        for (qsizetype back = 1; back <= qMin<qsizetype>(3, n); ++back) {
+            const uchar b = p[n - back];
+            if ((b & 0xC0) == 0x80) continue; // continuation byte
+            const int len = b >= 0xF0 ? 4 : b >= 0xE0 ? 3 : b >= 0xC0 ? 2 : 1;
+            if (len > back) keep = back;
+            break;
+        }
+        if (keep == 0 && n > 0 && p[n - 1] == '\r') keep = 1;
+        break;
+    case Encoding::Utf16Le:
+    case Encoding::Utf16Be: {
+        keep = n & 1;
+        const qsizetype m = n - keep;
+        const bool be = e == Encoding::Utf16Be;
+        if (m >= 2) {
+            const char16_t last = be ? char16_t(p[m - 2] << 8 | p[m - 1]) : char16_t(p[m - 1] << 8 | p[m - 2]);
+            if (last == '\r' || (last >= 0xD800 && last < 0xDC00)) keep += 2;
+        }
+        break;
+    }
+    case Encoding::Cp1251:
+    case Encoding::Koi8u:
+        keep = n > 0 && p[n - 1] == '\r' ? 1 : 0;
+        break;
+    }
+    return keep;
+}
+
+// Outcome of readAppended().
+struct Appended {
+    QString text;     // decoded, newlines normalised
+    DiskStamp stamp;  // covers the bytes consumed
+};
+
+// If the file at path still starts with what `known` describes, decodes the
+// bytes added after it. False means the file changed some other way.
+inline bool readAppended(const QString &path, const DiskStamp &known, Encoding enc, Appended &out) {
+    OPI_TRACE_SCOPE("reload::readAppended");
+    QFile f(path);
+    if (known.size < 0 || !f.open(QIODevice::ReadOnly)) return false;
+    const qint64 size = f.size();
+    if (size <= known.size) return false;
+    const qint64 overlap = qMin(known.size, tailBytes);
+    if (!f.seek(known.size - overlap)) return false;
+    const QByteArray bytes = f.read(size - known.size + overlap);
+    if (bytes.size() != size - known.size + overlap) return false;
+    if (hashTail(bytes.constData() + overlap, known.size) != known.tailHash) return false;
+
+    const QByteArray added = QByteArray::fromRawData(bytes.constData() + overlap, bytes.size() - overlap);
+    const qsizetype consumed = added.size() - incompleteTail(added, enc);
+    out.text = textcodec::decodeLines(added.constData(), consumed, enc);
+    out.stamp.size = known.size + consumed;
+    out.stamp.tailHash = hashTail(bytes.constData() + overlap + consumed, out.stamp.size);
+    return true;
+}
+
+// Turns doc into b by applying r.edits (from diff::compute(doc text, b)) as
+// one undo step, so the cursor and scroll position outside them survive.
+inline void applyDiff(QTextDocument *doc, const diff::Result &r, const QString &b) {
+    if (r.edits.empty()) return;
+    OPI_TRACE_SCOPE("reload::applyDiff");
+    QTextCursor c(doc);
+    c.beginEditBlock();
+    for (auto it = r.edits.rbegin(); it != r.edits.rend(); ++it) {
+        c.setPosition(int(it->aPos));
+        c.setPosition(int(it->aPos + it->aLen), QTextCursor::KeepAnchor);
+        c.insertText(b.mid(it->bPos, it->bLen));
+    }
+    c.endEditBlock();
+}
+
+} // namespace reload
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <QApplication>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QTemporaryDir>
+#include <QTextCursor>
+#include <QTimer>
+
+#include "editor.h"
+#include "edittrace.h"
+
+// ---------------- Replay ----------------
+// Plays a recorded trace back into the editor, either with the recorded
+// pauses or as fast as the event loop allows, then prints where the time went
+// (paragraph counting, autosave, notifications) and quits.
+class TraceReplayer {
+    class ReplayObserver : public IObserver {
+    public:
+        int deleted = 0;
+        int saved = 0;
+        void onParagraphsDeleted(int) override { ++deleted; }
+        void onAutoSaved(const QString &) override { ++saved; }
+    };
+
+    EditorWindow *w;
+    EditTrace trace;
+    bool maxSpeed;
+    QString startFile;
+    QTemporaryDir workDir;
+    ReplayObserver counter;
+    int next = 0;
+    int recordedAutosaves = 0;
+    QElapsedTimer clock;
+
+public:
+    // startFile overrides the path stored in the trace's first Open event.
+    TraceReplayer(EditorWindow *window, EditTrace t, bool fast, const QString &file = QString())
+        : w(window), trace(std::move(t)), maxSpeed(fast), startFile(file) {}
+
+    void start() {
+        // Message boxes are modal and would stall the replay.
+        w->observers().remove(w->messageObserver());
+        w->observers().add(&counter);
+        if (!startFile.isEmpty() && (trace.isEmpty() || trace.first().kind != EditOp::Open)) {
+            EditOp open;
+            open.kind = EditOp::Open;
+            trace.prepend(open);
+        }
+        clock.start();
+        schedule();
+    }
+
+private:
+    void schedule() {
+        if (next >= trace.size()) {
+            finish();
+            return;
+        }
+        const qint64 delay = maxSpeed ? 0 : qMax<qint64>(0, trace[next].atMs - clock.elapsed());
+        QTimer::singleShot(int(delay), w, [this]() {
+            apply(trace[next++]);
+            schedule();
+        });
+    }
+
+    void apply(const EditOp &op) {
+        switch (op.kind) {
+        case EditOp::Open: {
+            // Work on a copy: autosave would otherwise overwrite the original.
+            const QString src = startFile.isEmpty() ? op.text : startFile;
+            const QString copy = workDir.filePath(QFileInfo(src).fileName());
+            QFile::remove(copy);
+            if (!QFile::copy(src, copy)) qWarning() << "replay: cannot copy" << src;
+            w->openFile(copy);
+            w->waitForOpen(); // the next edits assume its text
+            break;
+        }
+        case EditOp::Save:
+            w->saveFile();
+            break;
+        case EditOp::AutoSave:
+            ++recordedAutosaves;
+            break;
+        case EditOp::Edit: {
+            QTextDocument *doc = w->textEdit()->document();
+            const int len = doc->characterCount() - 1;
+            const int pos = qBound(0, op.pos, len);
+            QTextCursor c(doc);
+            c.setPosition(pos);
+            c.setPosition(qMin(len, pos + op.removed), QTextCursor::KeepAnchor);
+            if (op.text.isEmpty()) c.removeSelectedText();
+            else c.insertText(op.text);
+            break;
+        }
+        }
+    }
+
+    static void print(const char *name, const TimingStat &s) {
+        qInfo("  %-10s %8lld calls %10.2f ms total %10.1f us mean %10.1f us max", name, s.count,
+              s.totalNs / 1e6, s.count ? s.totalNs / 1e3 / double(s.count) : 0.0, s.maxNs / 1e3);
+    }
+
+    void finish() {
+        // Let in-flight autosaves complete and report back.
+        w->autosaveBackend().waitForIdle();
+        QCoreApplication::processEvents();
+        const EditorProfile &p = w->profile();
+        qInfo("replay: %lld events in %lld ms (%s speed)", qint64(trace.size()), clock.elapsed(),
+              maxSpeed ? "max" : "recorded");
+        qInfo("  autosaves: recorded %d, replayed %d; paragraph deletions notified: %d",
+              recordedAutosaves, counter.saved, counter.deleted);
+        print("handler", p.handler);
+        print("counting", p.counting);
+        print("autosave", p.autosave);
+        print("notify", p.notify);
+        QApplication::quit();
+    }
+};
@@ -0,0 +1,247 @@
+#pragma once
+
+#include <QMetaObject>
+#include <QObject>
+#include <QThread>
+#include <QtGlobal>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// ---------------- Scheduler ----------------
+// One work-stealing thread pool, sized to the hardware, for all background
+// work (statistics, diffing, autosave writes). Each worker owns a deque per
+// priority: it pops its own newest task first and, when idle, steals the
+// oldest task of another worker, always trying higher priorities first.
+// Submissions from outside the pool are spread round-robin.
+//
+// Tasks can belong to a TaskGroup (one per document) that can be waited on,
+// and submit(..., context, then) runs a continuation on the thread of a
+// QObject (the GUI thread for widgets).
+namespace sched {
+
+enum class Priority : quint8 {
+    Interactive, // the user is waiting for it
+    Visible,     // affects what is on screen
+    Background,  // saves, statistics
+    Idle,        // only when nothing else is queued
+};
+constexpr int priorities = 4;
+
+inline const char *priorityName(Priority p) {
+    switch (p) {
+    case Priority::Interactive: return "interactive";
+    case Priority::Visible: return "visible";
+    case Priority::Background: return "background";
+    case Priority::Idle: return "idle";
+    }
+    return "?";
+}
+
+using Task = std::function<void()>;
+
+struct Stats {
+    int workers = 0;
+    qint64 queued[priorities] = {};    // waiting now
+    qint64 executed[priorities] = {};  // completed since start
+    qint64 steals = 0;                 // tasks taken from another worker's deque
+};
+
+// Tasks submitted on behalf of one owner (a document), so it can wait for
+// them. The group must outlive its tasks.
+class TaskGroup {
+public:
+    ~TaskGroup() { wait(); }
+
+    int pending() const { return count.load(); }
+
+    // Blocks until every task of the group has run. On a worker thread the
+    // wait runs other queued tasks instead, so nested waits cannot deadlock.
+    inline void wait();
+
+private:
+    friend class Scheduler;
+    std::atomic<int> count{0};
+    std::mutex mu;
+    std::condition_variable done;
+
+    void finished() {
+        std::lock_guard<std::mutex> lock(mu); // the waiter may destroy the group once count is 0
+        if (--count == 0) done.notify_all();
+    }
+};
+
+namespace detail {
+inline thread_local int currentWorker = -1;
+}
+
+class Scheduler {
+public:
+    static Scheduler &instance() {
+        static Scheduler s;
+        return s;
+    }
+
+    ~Scheduler() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMu);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread &t : threads) t.join();
+    }
+
+    int workerCount() const { return int(workers.size()); }
+    static bool onWorker() { return detail::currentWorker >= 0; }
+
+    void submit(Priority p, Task fn, TaskGroup *group = nullptr) {
+        if (group) ++group->count;
+        const int self = detail::currentWorker;
+        Worker &w = *workers[size_t(self >= 0 ? self : int(nextWorker++ % workers.size()))];
+        // Counted before a thief can see the task, so claimed() never takes
+        // the counts below zero.
+        ++depth[int(p)];
+        {
+            std::lock_guard<std::mutex> lock(sleepMu);
+            ++queued;
+        }
+        {
+            std::lock_guard<std::mutex> lock(w.mu);
+            w.queues[int(p)].push_back({std::move(fn), group, p});
+        }
+        wake.notify_one();
+    }
+
+    // Runs work() on the pool and then(result) on context's thread.
+    template <class Work, class Then>
+    void submit(Priority p, Work work, QObject *context, Then then, TaskGroup *group = nullptr) {
+        submit(p, [work = std::move(work), then = std::move(then), context]() mutable {
+            auto result = work();
+            QMetaObject::invokeMethod(context, [then = std::move(then), result = std::move(result)]() mutable { then(std::move(result)); },
+                                      Qt::QueuedConnection);
+        }, group);
+    }
+
+    // Runs one queued task on the calling thread; false if there was none.
+    bool runOne() {
+        Entry e;
+        if (!take(detail::currentWorker, e)) return false;
+        run(e);
+        return true;
+    }
+
+    Stats stats() const {
+        Stats s;
+        s.workers = workerCount();
+        for (int p = 0; p < priorities; ++p) {
+            s.queued[p] = depth[p];
+            s.executed[p] = executed[p];
+        }
+        s.steals = steals;
+        return s;
+    }
+
+private:
+    struct Entry {
+        Task fn;
+        TaskGroup *group = nullptr;
+        Priority priority = Priority::Background;
+    };
+    struct Worker {
+        std::mutex mu;
+        std::deque<Entry> queues[priorities];
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+    std::atomic<unsigned> nextWorker{0};
+    std::mutex sleepMu;
+    std::condition_variable wake;
+    qint64 queued = 0; // under sleepMu
+    bool stopping = false;
+    std::atomic<qint64> depth[priorities] = {}, executed[priorities] = {};
+    std::atomic<qint64> steals{0};
+
+    Scheduler() {
+        const int n = qMax(2, QThread::idealThreadCount());
+        for (int i = 0; i < n; ++i) workers.push_back(std::make_unique<Worker>());
+        for (int i = 0; i < n; ++i) threads.emplace_back([this, i]() { loop(i); });
+    }
+
+    bool take(int self, Entry &out) {
+        const int n = int(workers.size());
+        for (int p = 0; p < priorities; ++p) {
+            if (depth[p] == 0) continue;
+            if (self >= 0) {
+                Worker &w = *workers[size_t(self)];
+                std::lock_guard<std::mutex> lock(w.mu);
+                if (!w.queues[p].empty()) {
+                    out = std::move(w.queues[p].back());
+                    w.queues[p].pop_back();
+                    return claimed(p);
+                }
+            }
+            for (int k = 1; k <= n; ++k) {
+                const int victim = ((self >= 0 ? self : 0) + k) % n;
+                if (victim == self) continue;
+                Worker &w = *workers[size_t(victim)];
+                std::lock_guard<std::mutex> lock(w.mu);
+                if (!w.queues[p].empty()) {
+                    out = std::move(w.queues[p].front());
+                    w.queues[p].pop_front();
+                    if (self >= 0) ++steals;
+                    return claimed(p);
+                }
+            }
+        }
+        return false;
+    }
+
+    bool claimed(int p) {
+        --depth[p];
+        std::lock_guard<std::mutex> lock(sleepMu);
+        --queued;
+        return true;
+    }
+
+    void run(Entry &e) {
+        e.fn();
+        ++executed[int(e.priority)];
+        if (e.group) e.group->finished();
+    }
+
+    void loop(int self) {
+        detail::currentWorker = self;
+        for (;;) {
+            Entry e;
+            if (take(self, e)) {
+                run(e);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleepMu);
+            if (queued > 0) continue; // another worker holds it for a moment
+            if (stopping) return;
+            wake.wait(lock, [this]() { return stopping || queued > 0; });
+        }
+    }
+};
+
+inline Scheduler &scheduler() { return Scheduler::instance(); }
+
+inline void TaskGroup::wait() {
+    while (count > 0) {
+        if (Scheduler::onWorker() && scheduler().runOne()) continue;
+        std::unique_lock<std::mutex> lock(mu);
+        done.wait_for(lock, std::chrono::milliseconds(Scheduler::onWorker() ? 1 : 50), [this]() { return count == 0; });
+    }
+    std::lock_guard<std::mutex> lock(mu); // until finished() has let go
+}
+
+} // namespace sched
@@ -0,0 +1,685 @@
+#pragma once
+
+#include <QByteArray>
+#include <QString>
+#include <QStringDecoder>
+#include <QtAlgorithms>
+#include <QtGlobal>
+#include <cstring>
+#include <memory>
+
+#include "cpu.h"
+
+// ---------------- On-disk text conventions ----------------
+// What a loader found in a file, so the saver can write it back the same way.
+enum class Newline : quint8 { Lf, CrLf };
+
+enum class Encoding : quint8 { Utf8, Utf16Le, Utf16Be, Cp1251, Koi8u };
+
+#if defined(Q_OS_WIN)
+constexpr Newline nativeNewline = Newline::CrLf;
+#else
+constexpr Newline nativeNewline = Newline::Lf;
+#endif
+
+struct TextFormat {
+    Encoding encoding = Encoding::Utf8;
+    Newline newline = nativeNewline;
+    bool bom = false; // the file started with a byte-order mark
+};
+
+inline const char *encodingName(Encoding e) {
+    switch (e) {
+    case Encoding::Utf8: return "UTF-8";
+    case Encoding::Utf16Le: return "UTF-16LE";
+    case Encoding::Utf16Be: return "UTF-16BE";
+    case Encoding::Cp1251: return "windows-1251";
+    case Encoding::Koi8u: return "KOI8-U";
+    }
+    return "UTF-8";
+}
+
+// ---------------- Decode front end ----------------
+// Loaders read the raw bytes and hand them here instead of relying on
+// QIODevice::Text: the encoding is detected, the bytes are decoded, newlines
+// are normalised to '\n' and the file's conventions are reported.
+namespace textcodec {
+
+namespace detail {
+// Upper halves of the single-byte code pages (0x80..0xFF).
+constexpr char16_t cp1251High[128] = {
+    0x0402, 0x0403, 0x201A, 0x0453, 0x201E, 0x2026, 0x2020, 0x2021, 0x20AC, 0x2030, 0x0409, 0x2039, 0x040A, 0x040C, 0x040B, 0x040F,
+    0x0452, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014, 0x0098, 0x2122, 0x0459, 0x203A, 0x045A, 0x045C, 0x045B, 0x045F,
+    0x00A0, 0x040E, 0x045E, 0x0408, 0x00A4, 0x0490, 0x00A6, 0x00A7, 0x0401, 0x00A9, 0x0404, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x0407,
+    0x00B0, 0x00B1, 0x0406, 0x0456, 0x0491, 0x00B5, 0x00B6, 0x00B7, 0x0451, 0x2116, 0x0454, 0x00BB, 0x0458, 0x0405, 0x0455, 0x0457,
+    0x0410, 0x0411, 0x0412, 0x0413, 0x0414, 0x0415, 0x0416, 0x0417, 0x0418, 0x0419, 0x041A, 0x041B, 0x041C, 0x041D, 0x041E, 0x041F,
+    0x0420, 0x0421, 0x0422, 0x0423, 0x0424, 0x0425, 0x0426, 0x0427, 0x0428, 0x0429, 0x042A, 0x042B, 0x042C, 0x042D, 0x042E, 0x042F,
+    0x0430, 0x0431, 0x0432, 0x0433, 0x0434, 0x0435, 0x0436, 0x0437, 0x0438, 0x0439, 0x043A, 0x043B, 0x043C, 0x043D, 0x043E, 0x043F,
+    0x0440, 0x0441, 0x0442, 0x0443, 0x0444, 0x0445, 0x0446, 0x0447, 0x0448, 0x0449, 0x044A, 0x044B, 0x044C, 0x044D, 0x044E, 0x044F,
+};
+
+// RFC 2319.
+constexpr char16_t koi8uHigh[128] = {
+    0x2500, 0x2502, 0x250C, 0x2510, 0x2514, 0x2518, 0x251C, 0x2524, 0x252C, 0x2534, 0x253C, 0x2580, 0x2584, 0x2588, 0x258C, 0x2590,
+    0x2591, 0x2592, 0x2593, 0x2320, 0x25A0, 0x2219, 0x221A, 0x2248, 0x2264, 0x2265, 0x00A0, 0x2321, 0x00B0, 0x00B2, 0x00B7, 0x00F7,
+    0x2550, 0x2551, 0x2552, 0x0451, 0x0454, 0x2554, 0x0456, 0x0457, 0x2557, 0x2558, 0x2559, 0x255A, 0x255B, 0x0491, 0x255D, 0x255E,
+    0x255F, 0x2560, 0x2561, 0x0401, 0x0404, 0x2563, 0x0406, 0x0407, 0x2566, 0x2567, 0x2568, 0x2569, 0x256A, 0x0490, 0x256C, 0x00A9,
+    0x044E, 0x0430, 0x0431, 0x0446, 0x0434, 0x0435, 0x0444, 0x0433, 0x0445, 0x0438, 0x0439, 0x043A, 0x043B, 0x043C, 0x043D, 0x043E,
+    0x043F, 0x044F, 0x0440, 0x0441, 0x0442, 0x0443, 0x0436, 0x0432, 0x044C, 0x044B, 0x0437, 0x0448, 0x044D, 0x0449, 0x0447, 0x044A,
+    0x042E, 0x0410, 0x0411, 0x0426, 0x0414, 0x0415, 0x0424, 0x0413, 0x0425, 0x0418, 0x0419, 0x041A, 0x041B, 0x041C, 0x041D, 0x041E,
+    0x041F, 0x042F, 0x0420, 0x0421, 0x0422, 0x0423, 0x0416, 0x0412, 0x042C, 0x042B, 0x0417, 0x0428, 0x042D, 0x0429, 0x0427, 0x042A,
+};
+
+inline const char16_t *highHalf(Encoding e) { return e == Encoding::Koi8u ? koi8uHigh : cp1251High; }
+
+// UTF-16 unit -> byte for encoding; unmappable characters become '?'.
+class ReverseTable {
+public:
+    explicit ReverseTable(const char16_t *high) : map(new uchar[0x10000]) {
+        std::memset(map.get(), '?', 0x10000);
+        for (int c = 0; c < 0x80; ++c) map[c] = uchar(c);
+        for (int b = 0; b < 0x80; ++b) map[high[b]] = uchar(0x80 + b);
+    }
+    uchar operator[](char16_t c) const { return map[c]; }
+
+private:
+    std::unique_ptr<uchar[]> map;
+};
+
+inline const ReverseTable &reverseTable(Encoding e) {
+    static const ReverseTable cp1251(cp1251High), koi8u(koi8uHigh);
+    return e == Encoding::Koi8u ? koi8u : cp1251;
+}
+
+// ---------------- Kernels ----------------
+// One implementation per cpu::Level; kernels() below holds the ones picked
+// for this CPU. Each vector loop leaves the tail to the scalar one.
+
+// Index of the first c at or after `from`, or n.
+inline qsizetype findUnitScalar(const char16_t *s, qsizetype from, qsizetype n, char16_t c) {
+    for (qsizetype i = from; i < n; ++i)
+        if (s[i] == c) return i;
+    return n;
+}
+
+inline qsizetype countLfScalar(const char16_t *s, qsizetype from, qsizetype to) {
+    qsizetype count = 0;
+    for (qsizetype i = from; i < to; ++i) count += s[i] == '\n';
+    return count;
+}
+
+// Single-byte code page to UTF-16; `high` maps 0x80..0xFF.
+inline void decodeBytesScalar(const uchar *p, qsizetype i, qsizetype n, char16_t *d, const char16_t *high) {
+    for (; i < n; ++i) d[i] = p[i] < 0x80 ? char16_t(p[i]) : high[p[i] - 0x80];
+}
+
+// Copies n UTF-16 units, swapping the bytes of each.
+inline void swapUtf16Scalar(const uchar *p, qsizetype n, char16_t *d) {
+    for (qsizetype i = 0; i < n; ++i) d[i] = char16_t(p[2 * i] << 8 | p[2 * i + 1]);
+}
+
+#ifdef OPI_CPU_SSE2
+inline qsizetype findUnitSse2(const char16_t *s, qsizetype from, qsizetype n, char16_t c) {
+    qsizetype i = from;
+    const __m128i v = _mm_set1_epi16(short(c));
+    for (; i + 8 <= n; i += 8) {
+        const int m = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i)), v));
+        if (m) return i + qCountTrailingZeroBits(quint32(m)) / 2;
+    }
+    return findUnitScalar(s, i, n, c);
+}
+
+inline qsizetype countLfSse2(const char16_t *s, qsizetype from, qsizetype to) {
+    qsizetype count = 0, i = from;
+    const __m128i lf = _mm_set1_epi16('\n');
+    for (; i + 8 <= to; i += 8)
+        count += qPopulationCount(quint32(_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i)), lf)))) / 2;
+    return count + countLfScalar(s, i, to);
+}
+
+// ASCII runs are widened a vector at a time, the rest 16 bytes at a time
+// through the table.
+inline void decodeBytesSse2(const uchar *p, qsizetype i, qsizetype n, char16_t *d, const char16_t *high) {
+    const __m128i zero = _mm_setzero_si128();
+    while (i < n) {
+        for (; i + 16 <= n; i += 16) {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+            if (_mm_movemask_epi8(v)) break;
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(d + i), _mm_unpacklo_epi8(v, zero));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(d + i + 8), _mm_unpackhi_epi8(v, zero));
+        }
+        const qsizetype stop = qMin(n, i + 16);
+        decodeBytesScalar(p, i, stop, d, high);
+        i = stop;
+    }
+}
+
+inline void swapUtf16Sse2(const uchar *p, qsizetype n, char16_t *d) {
+    qsizetype i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 2 * i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(d + i), _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8)));
+    }
+    swapUtf16Scalar(p + 2 * i, n - i, d + i);
+}
+#endif
+
+#ifdef OPI_CPU_X86
+OPI_TARGET_AVX2 inline qsizetype findUnitAvx2(const char16_t *s, qsizetype from, qsizetype n, char16_t c) {
+    qsizetype i = from;
+    const __m256i v = _mm256_set1_epi16(short(c));
+    for (; i + 16 <= n; i += 16) {
+        const int m = _mm256_movemask_epi8(_mm256_cmpeq_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i)), v));
+        if (m) return i + qCountTrailingZeroBits(quint32(m)) / 2;
+    }
+    return findUnitSse2(s, i, n, c);
+}
+
+OPI_TARGET_AVX2 inline qsizetype countLfAvx2(const char16_t *s, qsizetype from, qsizetype to) {
+    qsizetype count = 0, i = from;
+    const __m256i lf = _mm256_set1_epi16('\n');
+    for (; i + 16 <= to; i += 16)
+        count += qPopulationCount(quint32(_mm256_movemask_epi8(_mm256_cmpeq_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i)), lf)))) / 2;
+    return count + countLfSse2(s, i, to);
+}
+
+OPI_TARGET_AVX2 inline void decodeBytesAvx2(const uchar *p, qsizetype i, qsizetype n, char16_t *d, const char16_t *high) {
+    while (i < n) {
+        for (; i + 32 <= n; i += 32) {
+            const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+            if (_mm256_movemask_epi8(v)) break;
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(d + i), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v)));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(d + i + 16), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1)));
+        }
+        const qsizetype stop = qMin(n, i + 16);
+        decodeBytesScalar(p, i, stop, d, high);
+        i = stop;
+    }
+}
+
+OPI_TARGET_AVX2 inline void swapUtf16Avx2(const uchar *p, qsizetype n, char16_t *d) {
+    qsizetype i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 2 * i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(d + i), _mm256_or_si256(_mm256_slli_epi16(v, 8), _mm256_srli_epi16(v, 8)));
+    }
+    swapUtf16Sse2(p + 2 * i, n - i, d + i);
+}
+
+// 32 units per step, compared straight into a mask register.
+OPI_TARGET_AVX512 inline qsizetype findUnitAvx512(const char16_t *s, qsizetype from, qsizetype n, char16_t c) {
+    qsizetype i = from;
+    const __m512i v = _mm512_set1_epi16(short(c));
+    for (; i + 32 <= n; i += 32) {
+        const __mmask32 m = _mm512_cmpeq_epi16_mask(_mm512_loadu_si512(s + i), v);
+        if (m) return i + qCountTrailingZeroBits(quint32(m));
+    }
+    return findUnitAvx2(s, i, n, c);
+}
+
+OPI_TARGET_AVX512 inline qsizetype countLfAvx512(const char16_t *s, qsizetype from, qsizetype to) {
+    qsizetype count = 0, i = from;
+    const __m512i lf = _mm512_set1_epi16('\n');
+    for (; i + 32 <= to; i += 32) count += qPopulationCount(quint32(_mm512_cmpeq_epi16_mask(_mm512_loadu_si512(s + i), lf)));
+    return count + countLfAvx2(s, i, to);
+}
+#endif
+
+#if defined(OPI_CPU_X86)
+#define OPI_KERNELS(name) {name##Scalar, name##Sse2, name##Avx2, name##Avx512}
+#define OPI_KERNELS_AVX2(name) {name##Scalar, name##Sse2, name##Avx2, nullptr}
+#elif defined(OPI_CPU_SSE2)
+#define OPI_KERNELS(name) {name##Scalar, name##Sse2, nullptr, nullptr}
+#define OPI_KERNELS_AVX2(name) OPI_KERNELS(name)
+#else
+#define OPI_KERNELS(name) {name##Scalar, nullptr, nullptr, nullptr}
+#define OPI_KERNELS_AVX2(name) OPI_KERNELS(name)
+#endif
+
+struct Kernels {
+    qsizetype (*findUnit)(const char16_t *, qsizetype, qsizetype, char16_t);
+    qsizetype (*countLf)(const char16_t *, qsizetype, qsizetype);
+    void (*decodeBytes)(const uchar *, qsizetype, qsizetype, char16_t *, const char16_t *);
+    void (*swapUtf16)(const uchar *, qsizetype, char16_t *);
+};
+
+inline const Kernels &kernels() {
+    using FindUnit = decltype(Kernels::findUnit);
+    using CountLf = decltype(Kernels::countLf);
+    using WidenAscii = decltype(Kernels::decodeBytes);
+    using SwapUtf16 = decltype(Kernels::swapUtf16);
+    static const FindUnit findUnit[] = OPI_KERNELS(findUnit);
+    static const CountLf countLf[] = OPI_KERNELS(countLf);
+    static const WidenAscii decodeBytes[] = OPI_KERNELS_AVX2(decodeBytes);
+    static const SwapUtf16 swapUtf16[] = OPI_KERNELS_AVX2(swapUtf16);
+    static const Kernels k{cpu::pick(findUnit), cpu::pick(countLf), cpu::pick(decodeBytes), cpu::pick(swapUtf16)};
+    return k;
+}
+
+#undef OPI_KERNELS
+#undef OPI_KERNELS_AVX2
+
+inline qsizetype findUnit(const char16_t *s, qsizetype from, qsizetype n, char16_t c) { return kernels().findUnit(s, from, n, c); }
+inline qsizetype findCr(const char16_t *s, qsizetype from, qsizetype n) { return findUnit(s, from, n, u'\r'); }
+inline qsizetype countLf(const char16_t *s, qsizetype from, qsizetype to) { return kernels().countLf(s, from, to); }
+} // namespace detail
+
+// Turns every CRLF into LF in place (lone CRs are kept, like QIODevice::Text)
+// and returns the convention most line breaks used. A string without any CR
+// is not touched, so it is not detached either. For text that is already
+// decoded; decodeLines() does the same while decoding.
+inline Newline normalizeNewlines(QString &text) {
+    const qsizetype n = text.size();
+    const char16_t *src = text.utf16();
+    const qsizetype firstCr = detail::findCr(src, 0, n);
+    if (firstCr == n) return Newline::Lf;
+
+    qsizetype lone = detail::countLf(src, 0, firstCr), pairs = 0;
+    char16_t *d = reinterpret_cast<char16_t *>(text.data()); // detaches; src is stale from here on
+    qsizetype w = firstCr, i = firstCr;
+    while (i < n) {
+        // Copy everything up to the next CR in one go.
+        const qsizetype cr = detail::findCr(d, i, n);
+        lone += detail::countLf(d, i, cr);
+        if (w != i) std::memmove(d + w, d + i, size_t(cr - i) * sizeof(char16_t));
+        w += cr - i;
+        i = cr;
+        if (i == n) break;
+        if (i + 1 < n && d[i + 1] == '\n') {
+            d[w++] = '\n';
+            i += 2;
+            ++pairs;
+        } else {
+            d[w++] = '\r';
+            ++i;
+        }
+    }
+    text.truncate(w);
+    return pairs > lone ? Newline::CrLf : Newline::Lf;
+}
+
+// ---------------- Detection ----------------
+constexpr qsizetype detectSample = 4096;
+
+namespace detail {
+// True if p[0..n) is UTF-8, allowing a sequence cut off by the sample's end.
+constexpr bool looksUtf8(const uchar *p, qsizetype n, bool truncated) {
+    qsizetype i = 0;
+    while (i < n) {
+        const uchar b = p[i];
+        if (b < 0x80) { ++i; continue; }
+        const int len = b >= 0xF0 && b <= 0xF4 ? 4 : b >= 0xE0 && b <= 0xEF ? 3 : b >= 0xC2 && b < 0xE0 ? 2 : 0;
+        if (len == 0) return false;
+        for (int k = 1; k < len; ++k) {
+            if (i + k >= n) return truncated;
+            if ((p[i + k] & 0xC0) != 0x80) return false;
+        }
+        i += len;
+    }
+    return true;
+}
+
+// 0xF5..0xFF never start a sequence, even when continuation bytes follow
+// (a Cyrillic letter after "х" in KOI8-U, "ї" in CP1251).
+constexpr uchar utf8Valid[] = {0xE2, 0x80, 0x94};
+constexpr uchar utf8BadLeadF5[] = {0xF5, 0x80, 0x80};
+constexpr uchar utf8BadLeadFF[] = {0xFF, 0xBF, 0xBF};
+static_assert(looksUtf8(utf8Valid, 3, false), "three-byte sequence");
+static_assert(!looksUtf8(utf8BadLeadF5, 3, false), "0xF5 is not a lead byte");
+static_assert(!looksUtf8(utf8BadLeadFF, 3, false), "0xFF is not a lead byte");
+
+// How much a decoded byte looks like Ukrainian prose: lower-case Cyrillic
+// dominates real text, while the wrong code page turns it into capitals,
+// box drawing or punctuation.
+inline int letterWeight(char16_t c) {
+    if ((c >= 0x0430 && c <= 0x044F) || c == 0x0456 || c == 0x0457 || c == 0x0454 || c == 0x0491) return 2;
+    if ((c >= 0x0410 && c <= 0x042F) || c == 0x0406 || c == 0x0407 || c == 0x0404 || c == 0x0490) return 1;
+    return -2;
+}
+} // namespace detail
+
+// Length of the byte-order mark of e, 0 for the single-byte code pages.
+inline qsizetype bomSize(Encoding e) {
+    switch (e) {
+    case Encoding::Utf8: return 3;
+    case Encoding::Utf16Le:
+    case Encoding::Utf16Be: return 2;
+    case Encoding::Cp1251:
+    case Encoding::Koi8u: return 0;
+    }
+    return 0;
+}
+
+// Guesses the encoding from a BOM (reported through *bom) or, failing that,
+// from the byte frequencies of the first detectSample bytes.
+inline Encoding detect(const char *data, qsizetype n, bool *bom = nullptr) {
+    const uchar *p = reinterpret_cast<const uchar *>(data);
+    if (bom) *bom = true;
+    if (n >= 2 && p[0] == 0xFF && p[1] == 0xFE) return Encoding::Utf16Le;
+    if (n >= 2 && p[0] == 0xFE && p[1] == 0xFF) return Encoding::Utf16Be;
+    if (n >= 3 && p[0] == 0xEF && p[1] == 0xBB && p[2] == 0xBF) return Encoding::Utf8;
+    if (bom) *bom = false;
+
+    const qsizetype m = qMin(n, detectSample);
+    qsizetype hist[256] = {};
+    for (qsizetype i = 0; i < m; ++i) ++hist[p[i]];
+
+    // BOM-less UTF-16: Latin and Cyrillic put 0x00 or 0x04 in every high byte.
+    const qsizetype pairs = m / 2;
+    if (pairs >= 4) {
+        qsizetype hiOdd = 0, hiEven = 0;
+        for (qsizetype i = 0; i + 1 < m; i += 2) {
+            hiEven += p[i] == 0x00 || p[i] == 0x04;
+            hiOdd += p[i + 1] == 0x00 || p[i + 1] == 0x04;
+        }
+        if (hiOdd * 10 > pairs * 7 && hiEven * 10 < pairs * 3) return Encoding::Utf16Le;
+        if (hiEven * 10 > pairs * 7 && hiOdd * 10 < pairs * 3) return Encoding::Utf16Be;
+    }
+
+    qsizetype high = 0;
+    for (int b = 0x80; b < 0x100; ++b) high += hist[b];
+    if (high == 0 || detail::looksUtf8(p, m, m < n)) return Encoding::Utf8;
+
+    qsizetype cp1251 = 0, koi8u = 0;
+    for (int b = 0x80; b < 0x100; ++b) {
+        cp1251 += hist[b] * detail::letterWeight(detail::cp1251High[b - 0x80]);
+        koi8u += hist[b] * detail::letterWeight(detail::koi8uHigh[b - 0x80]);
+    }
+    return koi8u > cp1251 ? Encoding::Koi8u : Encoding::Cp1251;
+}
+
+// ---------------- Decoders ----------------
+namespace detail {
+inline QString decodeSingleByte(const uchar *p, qsizetype n, const char16_t *high) {
+    QString out(n, Qt::Uninitialized);
+    char16_t *d = reinterpret_cast<char16_t *>(out.data());
+    kernels().decodeBytes(p, 0, n, d, high);
+    return out;
+}
+
+// Copies n UTF-16 units, swapping the bytes of each if asked.
+inline void copyUtf16(const uchar *p, qsizetype n, char16_t *d, bool swap) {
+    if (!swap) {
+        std::memcpy(d, p, size_t(n) * sizeof(char16_t));
+        return;
+    }
+    kernels().swapUtf16(p, n, d);
+}
+
+inline bool hostIsBigEndian() { return Q_BYTE_ORDER == Q_BIG_ENDIAN; }
+
+inline QString decodeUtf16(const uchar *p, qsizetype n, bool bigEndian) {
+    const qsizetype units = n / 2;
+    QString out(units + (n & 1), Qt::Uninitialized);
+    char16_t *d = reinterpret_cast<char16_t *>(out.data());
+    copyUtf16(p, units, d, bigEndian != hostIsBigEndian());
+    if (n & 1) d[units] = 0xFFFD; // dangling byte
+    return out;
+}
+} // namespace detail
+
+// Bytes in a known encoding to text, newlines untouched. A BOM is decoded
+// like any other character (U+FEFF); decode() skips it.
+inline QString decodeAs(const char *data, qsizetype n, Encoding e) {
+    const uchar *p = reinterpret_cast<const uchar *>(data);
+    switch (e) {
+    case Encoding::Utf8: return QString::fromUtf8(data, n);
+    case Encoding::Utf16Le: return detail::decodeUtf16(p, n, false);
+    case Encoding::Utf16Be: return detail::decodeUtf16(p, n, true);
+    case Encoding::Cp1251:
+    case Encoding::Koi8u: return detail::decodeSingleByte(p, n, detail::highHalf(e));
+    }
+    return QString::fromUtf8(data, n);
+}
+inline QString decodeAs(const QByteArray &bytes, Encoding e) { return decodeAs(bytes.constData(), bytes.size(), e); }
+
+namespace detail {
+// Decodes source units [0, n) one run at a time, leaving out the CR of every
+// CRLF, so the text never needs a second pass. findCr(from) is the next CR
+// at or after from (n if none), isLf(i) tells whether unit i is LF, and
+// copy(from, to, d) decodes [from, to) to d and returns the units written.
+// Returns the length of the output; *newline gets the convention most line
+// breaks used.
+template <class FindCr, class IsLf, class Copy>
+inline qsizetype decodeRuns(qsizetype n, qsizetype firstCr, char16_t *d, Newline *newline, FindCr findCr, IsLf isLf,
+                            Copy copy) {
+    qsizetype w = 0, start = 0, lfs = 0, pairs = 0;
+    const auto run = [&](qsizetype to) {
+        const qsizetype k = copy(start, to, d + w);
+        lfs += countLf(d, w, w + k);
+        w += k;
+    };
+    for (qsizetype cr = firstCr; cr < n; cr = findCr(cr + 1)) {
+        if (cr + 1 < n && isLf(cr + 1)) {
+            run(cr);
+            start = cr + 1; // the LF starts the next run
+            ++pairs;
+        }
+    }
+    run(n);
+    if (newline) *newline = pairs > lfs - pairs ? Newline::CrLf : Newline::Lf; // each pair left its LF
+    return w;
+}
+} // namespace detail
+
+// decodeAs() plus normalizeNewlines() in one pass: every CRLF becomes LF as
+// it is decoded (lone CRs are kept), and *newline gets the convention most
+// line breaks used. Text without a CR takes the plain decodeAs() path. UTF-8
+// is decoded line by line, so a sequence cut short by a CR turns into U+FFFD
+// there, as it would in QString::fromUtf8().
+inline QString decodeLines(const char *data, qsizetype n, Encoding e, Newline *newline = nullptr) {
+    if (newline) *newline = Newline::Lf;
+    const uchar *p = reinterpret_cast<const uchar *>(data);
+    QString out;
+    qsizetype w = 0;
+    if (e == Encoding::Utf16Le || e == Encoding::Utf16Be) {
+        const bool swap = (e == Encoding::Utf16Be) != detail::hostIsBigEndian();
+        const char16_t cr = swap ? char16_t(0x0D00) : u'\r', lf = swap ? char16_t(0x0A00) : u'\n';
+        const char16_t *s = reinterpret_cast<const char16_t *>(data);
+        const qsizetype units = n / 2;
+        const qsizetype firstCr = detail::findUnit(s, 0, units, cr);
+        if (firstCr == units) return decodeAs(data, n, e);
+        out = QString(units + (n & 1), Qt::Uninitialized);
+        char16_t *d = reinterpret_cast<char16_t *>(out.data());
+        w = detail::decodeRuns(
+            units, firstCr, d, newline, [&](qsizetype from) { return detail::findUnit(s, from, units, cr); },
+            [&](qsizetype i) { return s[i] == lf; },
+            [&](qsizetype from, qsizetype to, char16_t *o) {
+                detail::copyUtf16(p + 2 * from, to - from, o, swap);
+                return to - from;
+            });
+        if (n & 1) d[w++] = 0xFFFD; // dangling byte
+    } else {
+        // CR and LF are the same byte in UTF-8 and both code pages, and never
+        // part of a multi-byte sequence.
+        const auto findCr = [&](qsizetype from) {
+            const void *c = std::memchr(data + from, '\r', size_t(n - from));
+            return c ? qsizetype(static_cast<const char *>(c) - data) : n;
+        };
+        const qsizetype firstCr = findCr(0);
+        if (firstCr == n) return decodeAs(data, n, e);
+        const auto isLf = [&](qsizetype i) { return data[i] == '\n'; };
+        if (e == Encoding::Utf8) {
+            QStringDecoder dec(QStringDecoder::Utf8, QStringDecoder::Flag::Stateless | QStringDecoder::Flag::ConvertInitialBom);
+            out = QString(dec.requiredSpace(n), Qt::Uninitialized);
+            w = detail::decodeRuns(n, firstCr, reinterpret_cast<char16_t *>(out.data()), newline, findCr, isLf,
+                                   [&](qsizetype from, qsizetype to, char16_t *o) {
+                                       QChar *begin = reinterpret_cast<QChar *>(o);
+                                       return qsizetype(dec.appendToBuffer(begin, QByteArrayView(data + from, to - from)) - begin);
+                                   });
+        } else {
+            const char16_t *high = detail::highHalf(e);
+            out = QString(n, Qt::Uninitialized);
+            w = detail::decodeRuns(n, firstCr, reinterpret_cast<char16_t *>(out.data()), newline, findCr, isLf,
+                                   [&](qsizetype from, qsizetype to, char16_t *o) {
+                                       detail::kernels().decodeBytes(p + from, 0, to - from, o, high);
+                                       return to - from;
+                                   });
+        }
+    }
+    out.truncate(w);
+    return out;
+}
+
+// Bytes from disk to editor text. The BOM, if any, is recorded in format and
+// left out of the text by starting the decoder past it.
+inline QString decode(const QByteArray &bytes, TextFormat &format) {
+    format.encoding = detect(bytes.constData(), bytes.size(), &format.bom);
+    const qsizetype skip = format.bom ? bomSize(format.encoding) : 0;
+    return decodeLines(bytes.constData() + skip, bytes.size() - skip, format.encoding, &format.newline);
+}
+
+// ---------------- Encoders ----------------
+// Used by utf8::Writer for the non-UTF-8 encodings. Each returns the number
+// of bytes written to dst, which needs room for maxBytesPerUnit() per unit.
+inline int maxBytesPerUnit(Encoding e) {
+    switch (e) {
+    case Encoding::Utf8: return 3;
+    case Encoding::Utf16Le:
+    case Encoding::Utf16Be: return 4; // "\r\n"
+    case Encoding::Cp1251:
+    case Encoding::Koi8u: return 2;
+    }
+    return 3;
+}
+
+namespace detail {
+// Encodes src[i..stop) through the table; a surrogate pair may end past stop.
+template <bool CrLf>
+inline char *encodeSingleByteUnits(const char16_t *src, qsizetype &i, qsizetype stop, qsizetype n, char *out, const ReverseTable &table) {
+    while (i < stop) {
+        const char16_t c = src[i++];
+        if (CrLf && c == '\n') *out++ = '\r';
+        *out++ = char(table[c]);
+        // One '?' per unmappable character, not per surrogate.
+        if (c >= 0xD800 && c < 0xDC00 && i < n && src[i] >= 0xDC00 && src[i] < 0xE000) ++i;
+    }
+    return out;
+}
+
+template <bool CrLf>
+inline qsizetype encodeSingleByteScalar(const char16_t *src, qsizetype n, char *dst, const ReverseTable &table) {
+    qsizetype i = 0;
+    return encodeSingleByteUnits<CrLf>(src, i, n, n, dst, table) - dst;
+}
+
+// The vector levels narrow ASCII runs a register at a time, then take 16
+// units through the table before looking for the next run.
+#ifdef OPI_CPU_SSE2
+template <bool CrLf>
+inline qsizetype encodeSingleByteSse2(const char16_t *src, qsizetype n, char *dst, const ReverseTable &table) {
+    char *out = dst;
+    qsizetype i = 0;
+    const __m128i nonAscii = _mm_set1_epi16(short(0xFF80));
+    while (i < n) {
+        for (; i + 16 <= n; i += 16) {
+            const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+            const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i + 8));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(_mm_or_si128(a, b), nonAscii), _mm_setzero_si128())) != 0xFFFF)
+                break;
+            if (CrLf) {
+                const __m128i lf = _mm_set1_epi16('\n');
+                if (_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi16(a, lf), _mm_cmpeq_epi16(b, lf)))) break;
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_packus_epi16(a, b));
+            out += 16;
+        }
+        out = encodeSingleByteUnits<CrLf>(src, i, qMin(n, i + 16), n, out, table);
+    }
+    return out - dst;
+}
+#endif
+
+#ifdef OPI_CPU_X86
+template <bool CrLf>
+OPI_TARGET_AVX2 inline qsizetype encodeSingleByteAvx2(const char16_t *src, qsizetype n, char *dst, const ReverseTable &table) {
+    char *out = dst;
+    qsizetype i = 0;
+    const __m256i nonAscii = _mm256_set1_epi16(short(0xFF80));
+    while (i < n) {
+        for (; i + 32 <= n; i += 32) {
+            const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+            const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i + 16));
+            if (!_mm256_testz_si256(_mm256_or_si256(a, b), nonAscii)) break;
+            if (CrLf) {
+                const __m256i lf = _mm256_set1_epi16('\n');
+                if (_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi16(a, lf), _mm256_cmpeq_epi16(b, lf)))) break;
+            }
+            // packus works per 128-bit lane; put the four quarters back in order.
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8));
+            out += 32;
+        }
+        out = encodeSingleByteUnits<CrLf>(src, i, qMin(n, i + 16), n, out, table);
+    }
+    return out - dst;
+}
+#endif
+
+using EncodeSingleByteFn = qsizetype (*)(const char16_t *, qsizetype, char *, const ReverseTable &);
+
+// Picked once for this CPU, like kernels(); AVX-512 uses the AVX2 encoder.
+struct SingleByteEncoders {
+    EncodeSingleByteFn lf, crlf;
+};
+
+inline const SingleByteEncoders &singleByteEncoders() {
+#if defined(OPI_CPU_X86)
+    static const EncodeSingleByteFn lf[] = {encodeSingleByteScalar<false>, encodeSingleByteSse2<false>, encodeSingleByteAvx2<false>, nullptr};
+    static const EncodeSingleByteFn crlf[] = {encodeSingleByteScalar<true>, encodeSingleByteSse2<true>, encodeSingleByteAvx2<true>, nullptr};
+#elif defined(OPI_CPU_SSE2)
+    static const EncodeSingleByteFn lf[] = {encodeSingleByteScalar<false>, encodeSingleByteSse2<false>, nullptr, nullptr};
+    static const EncodeSingleByteFn crlf[] = {encodeSingleByteScalar<true>, encodeSingleByteSse2<true>, nullptr, nullptr};
+#else
+    static const EncodeSingleByteFn lf[] = {encodeSingleByteScalar<false>, nullptr, nullptr, nullptr};
+    static const EncodeSingleByteFn crlf[] = {encodeSingleByteScalar<true>, nullptr, nullptr, nullptr};
+#endif
+    static const SingleByteEncoders e{cpu::pick(lf), cpu::pick(crlf)};
+    return e;
+}
+
+// No kernel of its own: the copies and the '\n' search go through kernels().
+template <bool CrLf>
+inline qsizetype encodeUtf16(const char16_t *src, qsizetype n, char *dst, bool bigEndian) {
+    const bool swap = bigEndian != hostIsBigEndian();
+    if (!CrLf) {
+        copyUtf16(reinterpret_cast<const uchar *>(src), n, reinterpret_cast<char16_t *>(dst), swap);
+        return n * 2;
+    }
+    char16_t *out = reinterpret_cast<char16_t *>(dst);
+    qsizetype i = 0;
+    while (i < n) {
+        // Copy up to the next '\n' in one go, then expand it.
+        const qsizetype lf = findUnit(src, i, n, u'\n');
+        copyUtf16(reinterpret_cast<const uchar *>(src + i), lf - i, out, swap);
+        out += lf - i;
+        i = lf;
+        if (i < n) {
+            const char16_t crlf[2] = {u'\r', u'\n'};
+            copyUtf16(reinterpret_cast<const uchar *>(crlf), 2, out, swap);
+            out += 2;
+            ++i;
+        }
+    }
+    return (out - reinterpret_cast<char16_t *>(dst)) * 2;
+}
+} // namespace detail
+
+// Encodes n units of src as e (not UTF-8, see utf8::encode).
+inline qsizetype encode(Encoding e, const char16_t *src, qsizetype n, char *dst, bool crlf) {
+    switch (e) {
+    case Encoding::Utf16Le:
+    case Encoding::Utf16Be: {
+        const bool be = e == Encoding::Utf16Be;
+        return crlf ? detail::encodeUtf16<true>(src, n, dst, be) : detail::encodeUtf16<false>(src, n, dst, be);
+    }
+    case Encoding::Cp1251:
+    case Encoding::Koi8u: {
+        const detail::ReverseTable &t = detail::reverseTable(e);
+        return (crlf ? detail::singleByteEncoders().crlf : detail::singleByteEncoders().lf)(src, n, dst, t);
+    }
+    case Encoding::Utf8: break;
+    }
+    return 0;
+}
+
+} // namespace textcodec
@@ -0,0 +1,299 @@
+#pragma once
+
+#include <QByteArray>
+#include <QIODevice>
+#include <QString>
+#include <QStringView>
+#include <QtGlobal>
+#include <cstring>
+#include <memory>
+
+#include "cancel.h"
+#include "cpu.h"
+#include "textcodec.h"
+
+// ---------------- Streaming UTF-8 writer ----------------
+// Encodes UTF-16 chunk by chunk into a sink's fixed buffers and writes each one
+// out as it fills, so a save needs a few MB of scratch space whatever the
+// document size. Runs of ASCII are narrowed a vector at a time. Unpaired
+// surrogates are written as U+FFFD, like QString::toUtf8(). The writer can
+// also produce the other encodings in textcodec.h.
+namespace utf8 {
+
+namespace detail {
+// Encodes src[i..stop) one unit at a time; a surrogate pair may end past stop.
+template <bool CrLf>
+inline char *encodeUnits(const char16_t *src, qsizetype &i, qsizetype stop, qsizetype n, char *out) {
+    while (i < stop) {
+        char32_t c = src[i++];
+        if (c < 0x80) {
+            if (CrLf && c == '\n') *out++ = '\r';
+            *out++ = char(c);
+            continue;
+        }
+        if (c < 0x800) {
+            *out++ = char(0xC0 | (c >> 6));
+            *out++ = char(0x80 | (c & 0x3F));
+            continue;
+        }
+        if (c >= 0xD800 && c < 0xE000) {
+            if (c < 0xDC00 && i < n && src[i] >= 0xDC00 && src[i] < 0xE000) {
+                c = 0x10000 + ((c - 0xD800) << 10) + (char32_t(src[i++]) - 0xDC00);
+                *out++ = char(0xF0 | (c >> 18));
+                *out++ = char(0x80 | ((c >> 12) & 0x3F));
+                *out++ = char(0x80 | ((c >> 6) & 0x3F));
+                *out++ = char(0x80 | (c & 0x3F));
+                continue;
+            }
+            c = 0xFFFD;
+        }
+        *out++ = char(0xE0 | (c >> 12));
+        *out++ = char(0x80 | ((c >> 6) & 0x3F));
+        *out++ = char(0x80 | (c & 0x3F));
+    }
+    return out;
+}
+
+// Each level narrows ASCII runs as wide as it can, then goes scalar for 16
+// units before looking for the next run.
+template <bool CrLf>
+inline qsizetype encodeScalar(const char16_t *src, qsizetype n, char *dst) {
+    char *out = dst;
+    qsizetype i = 0;
+    while (i < n) {
+        while (i + 4 <= n) {
+            quint64 w;
+            std::memcpy(&w, src + i, sizeof(w));
+            if (w & Q_UINT64_C(0xFF80FF80FF80FF80)) break;
+            if (CrLf && (src[i] == '\n' || src[i + 1] == '\n' || src[i + 2] == '\n' || src[i + 3] == '\n')) break;
+            for (int k = 0; k < 4; ++k) out[k] = char(src[i + k]);
+            i += 4;
+            out += 4;
+        }
+        out = encodeUnits<CrLf>(src, i, qMin(n, i + 16), n, out);
+    }
+    return out - dst;
+}
+
+#ifdef OPI_CPU_SSE2
+template <bool CrLf>
+inline qsizetype encodeSse2(const char16_t *src, qsizetype n, char *dst) {
+    char *out = dst;
+    qsizetype i = 0;
+    const __m128i nonAscii = _mm_set1_epi16(short(0xFF80));
+    while (i < n) {
+        while (i + 16 <= n) {
+            const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+            const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i + 8));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(_mm_or_si128(a, b), nonAscii), _mm_setzero_si128())) != 0xFFFF)
+                break;
+            if (CrLf) {
+                const __m128i lf = _mm_set1_epi16('\n');
+                if (_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi16(a, lf), _mm_cmpeq_epi16(b, lf)))) break;
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_packus_epi16(a, b));
+            i += 16;
+            out += 16;
+        }
+        out = encodeUnits<CrLf>(src, i, qMin(n, i + 16), n, out);
+    }
+    return out - dst;
+}
+#endif
+
+#ifdef OPI_CPU_X86
+template <bool CrLf>
+OPI_TARGET_AVX2 inline qsizetype encodeAvx2(const char16_t *src, qsizetype n, char *dst) {
+    char *out = dst;
+    qsizetype i = 0;
+    const __m256i nonAscii = _mm256_set1_epi16(short(0xFF80));
+    while (i < n) {
+        while (i + 32 <= n) {
+            const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+            const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i + 16));
+            if (!_mm256_testz_si256(_mm256_or_si256(a, b), nonAscii)) break;
+            if (CrLf) {
+                const __m256i lf = _mm256_set1_epi16('\n');
+                if (_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi16(a, lf), _mm256_cmpeq_epi16(b, lf)))) break;
+            }
+            // packus works per 128-bit lane; put the four quarters back in order.
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8));
+            i += 32;
+            out += 32;
+        }
+        out = encodeUnits<CrLf>(src, i, qMin(n, i + 16), n, out);
+    }
+    return out - dst;
+}
+#endif
+
+using EncodeFn = qsizetype (*)(const char16_t *, qsizetype, char *);
+
+// Picked once for this CPU (see cpu.h); AVX-512 uses the AVX2 encoder.
+struct Encoders {
+    EncodeFn lf, crlf;
+};
+
+inline const Encoders &encoders() {
+#if defined(OPI_CPU_X86)
+    static const EncodeFn lf[] = {encodeScalar<false>, encodeSse2<false>, encodeAvx2<false>, nullptr};
+    static const EncodeFn crlf[] = {encodeScalar<true>, encodeSse2<true>, encodeAvx2<true>, nullptr};
+#elif defined(OPI_CPU_SSE2)
+    static const EncodeFn lf[] = {encodeScalar<false>, encodeSse2<false>, nullptr, nullptr};
+    static const EncodeFn crlf[] = {encodeScalar<true>, encodeSse2<true>, nullptr, nullptr};
+#else
+    static const EncodeFn lf[] = {encodeScalar<false>, nullptr, nullptr, nullptr};
+    static const EncodeFn crlf[] = {encodeScalar<true>, nullptr, nullptr, nullptr};
+#endif
+    static const Encoders e{cpu::pick(lf), cpu::pick(crlf)};
+    return e;
+}
+} // namespace detail
+
+// Encodes src into dst (room for 3 bytes per unit) and returns the byte count,
+// writing "\r\n" for every '\n' if crlf is set. The caller must not split a
+// surrogate pair across calls.
+inline qsizetype encode(const char16_t *src, qsizetype n, char *dst, bool crlf = false) {
+    return (crlf ? detail::encoders().crlf : detail::encoders().lf)(src, n, dst);
+}
+
+// Destination of the encoded chunks.
+class Sink {
+public:
+    virtual ~Sink() = default;
+    // Buffer for the next chunk; the same one until commit() is called.
+    virtual char *acquire(qsizetype &capacity) = 0;
+    // Writes the first len bytes of the acquired buffer; false on error.
+    virtual bool commit(qsizetype len) = 0;
+};
+
+// Writes each chunk to a QIODevice from a 4 MB per-thread scratch buffer.
+// One at a time per thread: they share the buffer.
+class DeviceSink : public Sink {
+public:
+    static constexpr qsizetype bufferSize = qsizetype(4) << 20;
+
+    explicit DeviceSink(QIODevice *device = nullptr) : dev(device) {}
+
+    char *acquire(qsizetype &capacity) override {
+        // Reused by every save on this thread instead of reallocating.
+        thread_local std::unique_ptr<char[]> scratch(new char[size_t(bufferSize)]);
+        buf = scratch.get();
+        capacity = bufferSize;
+        return buf;
+    }
+    bool commit(qsizetype len) override { return dev->write(buf, len) == len; }
+
+private:
+    QIODevice *dev;
+    char *buf = nullptr;
+};
+
+class Writer {
+public:
+    explicit Writer(Sink *s) : sink(s) {}
+    explicit Writer(QIODevice *device) : deviceSink(device), sink(&deviceSink) {}
+    ~Writer() { flush(); }
+
+    Writer(const Writer &) = delete;
+    Writer &operator=(const Writer &) = delete;
+
+    // Selects the encoding (UTF-8 by default) and the line ending written for
+    // each '\n', and writes a BOM if the loaded file had one. Call before any text.
+    void start(const TextFormat &format) {
+        enc = format.encoding;
+        crlf = format.newline == Newline::CrLf;
+        unitBytes = textcodec::maxBytesPerUnit(enc);
+        if (format.bom && textcodec::bomSize(enc) > 0) *this << QStringView(u"\uFEFF");
+    }
+
+    Writer &operator<<(QStringView s) {
+        const char16_t *p = s.utf16();
+        qsizetype n = s.size();
+        while (n > 0 && reserve(64 * unitBytes)) {
+            qsizetype take = qMin(n, (cap - used) / unitBytes);
+            // Keep a surrogate pair together.
+            if (take < n && take > 1 && p[take - 1] >= 0xD800 && p[take - 1] < 0xDC00) --take;
+            used += enc == Encoding::Utf8 ? encode(p, take, buf + used, crlf)
+                                          : textcodec::encode(enc, p, take, buf + used, crlf);
+            p += take;
+            n -= take;
+        }
+        return *this;
+    }
+
+    // Bytes that are already UTF-8 (markup, entities). Other encodings only
+    // get ASCII this way, which is widened and encoded like text.
+    Writer &operator<<(const char *utf8) {
+        if (enc != Encoding::Utf8) {
+            char16_t wide[256];
+            while (*utf8) {
+                qsizetype k = 0;
+                for (; k < 256 && utf8[k]; ++k) wide[k] = uchar(utf8[k]);
+                *this << QStringView(wide, k);
+                utf8 += k;
+            }
+            return *this;
+        }
+        if (!crlf) {
+            append(utf8, qsizetype(std::strlen(utf8)));
+            return *this;
+        }
+        while (const char *lf = std::strchr(utf8, '\n')) {
+            append(utf8, lf - utf8);
+            append("\r\n", 2);
+            utf8 = lf + 1;
+        }
+        append(utf8, qsizetype(std::strlen(utf8)));
+        return *this;
+    }
+
+    // Hands the current chunk to the sink.
+    bool flush() {
+        if (used > 0 && !failed) failed = !sink->commit(used);
+        used = 0;
+        buf = nullptr;
+        return !failed;
+    }
+
+    // False once any write failed, or the token was cancelled.
+    bool ok() const { return !failed; }
+
+    // Checked before each chunk: once cancelled, nothing more is written.
+    void setCancelToken(const cancel::Token &t) { cancelToken = t; }
+    bool cancelled() const { return cancelToken.cancelled(); }
+
+private:
+    DeviceSink deviceSink;
+    Sink *sink;
+    char *buf = nullptr;
+    qsizetype cap = 0;
+    qsizetype used = 0;
+    bool failed = false;
+    bool crlf = false;
+    Encoding enc = Encoding::Utf8;
+    int unitBytes = 3;
+    cancel::Token cancelToken;
+
+    void append(const char *bytes, qsizetype len) {
+        while (len > 0 && reserve(1)) {
+            const qsizetype take = qMin(len, cap - used);
+            std::memcpy(buf + used, bytes, size_t(take));
+            used += take;
+            bytes += take;
+            len -= take;
+        }
+    }
+
+    // Makes room for at least `bytes`, flushing a full chunk first.
+    bool reserve(qsizetype bytes) {
+        if (buf && cap - used < bytes) flush();
+        if (!buf && !failed) {
+            if (cancelToken.cancelled()) failed = true;
+            else buf = sink->acquire(cap);
+        }
+        return !failed;
+    }
+};
+
+} // namespace utf8
@@ -0,0 +1,204 @@
+#pragma once
+
+#include <QByteArray>
+#include <QCoreApplication>
+#include <QFile>
+#include <QString>
+#include <QThread>
+#include <QtGlobal>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// ---------------- Tracing ----------------
+// Scoped spans recorded into per-thread ring buffers and exported as Chrome
+// trace-event JSON (open in Perfetto or chrome://tracing).
+//
+//   OPI_TRACE_SCOPE("htmlToPlain");
+//
+// Recording is off until tracing::setEnabled(true); with every mode off a
+// span costs one relaxed atomic load. Building with DEFINES += OPI_NO_TRACING
+// removes the macros entirely. Span names must be string literals.
+namespace tracing {
+
+struct Event {
+    const char *name;
+    qint64 startNs;
+    qint64 durNs;
+};
+
+// Record: keep finished spans for export. ActiveStack: keep each thread's
+// currently open spans readable from other threads (stall watchdog).
+enum Mode : int { Record = 1, ActiveStack = 2 };
+
+inline std::atomic<int> &modeFlags() {
+    static std::atomic<int> flags{0};
+    return flags;
+}
+inline void setMode(Mode m, bool on) {
+    if (on) modeFlags().fetch_or(m, std::memory_order_relaxed);
+    else modeFlags().fetch_and(~int(m), std::memory_order_relaxed);
+}
+inline bool isEnabled() { return modeFlags().load(std::memory_order_relaxed) & Record; }
+inline void setEnabled(bool on) { setMode(Record, on); }
+inline void setActiveStackTracking(bool on) { setMode(ActiveStack, on); }
+
+inline qint64 nowNs() {
+    static const auto epoch = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+class ThreadBuffer {
+public:
+    static constexpr size_t capacity = size_t(1) << 18; // newest events win
+
+    ThreadBuffer(int id, QString threadName) : tid(id), name(std::move(threadName)) {}
+
+    void push(const Event &e) {
+        std::lock_guard<std::mutex> lock(mu); // uncontended except while exporting
+        if (events.size() < capacity) events.push_back(e);
+        else events[head++ % capacity] = e;
+    }
+
+    template <typename Fn> void forEach(Fn &&fn) const {
+        std::lock_guard<std::mutex> lock(mu);
+        for (const Event &e : events) fn(e);
+    }
+
+    // Owner thread only.
+    void enter(const char *span) {
+        const int d = depth.load(std::memory_order_relaxed);
+        if (d < maxDepth) active[d].store(span, std::memory_order_relaxed);
+        depth.store(d + 1, std::memory_order_release);
+    }
+    void leave() { depth.store(depth.load(std::memory_order_relaxed) - 1, std::memory_order_release); }
+
+    // Any thread; a best-effort snapshot, outermost span first.
+    std::vector<const char *> activeStack() const {
+        std::vector<const char *> out;
+        const int d = qMin(depth.load(std::memory_order_acquire), maxDepth);
+        for (int i = 0; i < d; ++i) out.push_back(active[i].load(std::memory_order_relaxed));
+        return out;
+    }
+
+    const int tid;
+    const QString name;
+
+private:
+    mutable std::mutex mu;
+    std::vector<Event> events;
+    size_t head = 0;
+
+    static constexpr int maxDepth = 32;
+    std::atomic<const char *> active[maxDepth] = {};
+    std::atomic<int> depth{0};
+};
+
+// Buffers outlive their threads so spans from finished workers still export.
+class Registry {
+public:
+    static Registry &instance() {
+        static Registry r;
+        return r;
+    }
+
+    std::shared_ptr<ThreadBuffer> create() {
+        std::lock_guard<std::mutex> lock(mu);
+        QString name = QThread::currentThread() ? QThread::currentThread()->objectName() : QString();
+        if (name.isEmpty()) name = buffers.empty() ? QString("main") : QString("thread %1").arg(buffers.size());
+        buffers.push_back(std::make_shared<ThreadBuffer>(int(buffers.size()) + 1, name));
+        return buffers.back();
+    }
+
+    std::vector<std::shared_ptr<ThreadBuffer>> all() const {
+        std::lock_guard<std::mutex> lock(mu);
+        return buffers;
+    }
+
+private:
+    mutable std::mutex mu;
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+};
+
+inline ThreadBuffer &threadBuffer() {
+    thread_local std::shared_ptr<ThreadBuffer> buf = Registry::instance().create();
+    return *buf;
+}
+
+class Span {
+    const char *name = nullptr;
+    ThreadBuffer *buf = nullptr;
+    qint64 start = 0;
+    int mode = 0;
+public:
+    explicit Span(const char *n) {
+        mode = modeFlags().load(std::memory_order_relaxed);
+        if (!mode) return;
+        name = n;
+        buf = &threadBuffer();
+        if (mode & ActiveStack) buf->enter(n);
+        if (mode & Record) start = nowNs();
+    }
+    ~Span() {
+        if (!mode) return;
+        if (mode & ActiveStack) buf->leave();
+        if (mode & Record) buf->push({name, start, nowNs() - start});
+    }
+    Span(const Span &) = delete;
+    Span &operator=(const Span &) = delete;
+};
+
+inline void appendJsonString(QByteArray &out, const QByteArray &s) {
+    out += '"';
+    for (char c : s) {
+        if (c == '"' || c == '\\') out += '\\';
+        if (quint8(c) >= 0x20) out += c;
+    }
+    out += '"';
+}
+
+// Writes every buffered span as Chrome trace-event JSON.
+inline bool exportChromeJson(const QString &path) {
+    QFile f(path);
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate)) return false;
+    const QByteArray pid = QByteArray::number(QCoreApplication::applicationPid());
+    QByteArray out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    auto sep = [&]() {
+        if (!first) out += ",\n";
+        first = false;
+    };
+    for (const auto &buf : Registry::instance().all()) {
+        const QByteArray tid = QByteArray::number(buf->tid);
+        sep();
+        out += "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":" + pid + ",\"tid\":" + tid + ",\"args\":{\"name\":";
+        appendJsonString(out, buf->name.toUtf8());
+        out += "}}";
+        buf->forEach([&](const Event &e) {
+            sep();
+            out += "{\"ph\":\"X\",\"name\":";
+            appendJsonString(out, e.name);
+            out += ",\"pid\":" + pid + ",\"tid\":" + tid;
+            out += ",\"ts\":" + QByteArray::number(double(e.startNs) / 1000.0, 'f', 3);
+            out += ",\"dur\":" + QByteArray::number(double(e.durNs) / 1000.0, 'f', 3) + "}";
+            if (out.size() > (4 << 20)) {
+                f.write(out);
+                out.clear();
+            }
+        });
+    }
+    out += "\n]}\n";
+    return f.write(out) == out.size();
+}
+
+} // namespace tracing
+
+#ifdef OPI_NO_TRACING
+#define OPI_TRACE_SCOPE(name) do {} while (0)
+#else
+#define OPI_TRACE_CAT2(a, b) a##b
+#define OPI_TRACE_CAT(a, b) OPI_TRACE_CAT2(a, b)
+#define OPI_TRACE_SCOPE(name) ::tracing::Span OPI_TRACE_CAT(opiTraceSpan_, __LINE__)(name)
+#endif
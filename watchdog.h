@@ -0,0 +1,218 @@
+#pragma once
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QFile>
+#include <QMetaObject>
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QtGlobal>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "tracing.h"
+
+#if defined(Q_OS_LINUX)
+#include <cxxabi.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <signal.h>
+#include <cstdlib>
+#endif
+
+// ---------------- Stall watchdog ----------------
+// A background thread pings the GUI event loop. When a ping goes unanswered
+// for longer than the threshold it logs the GUI thread's open tracing spans,
+// a stack sample (Linux), the document size and the current user action.
+namespace watchdog {
+
+inline std::atomic<const char *> &currentAction() {
+    static std::atomic<const char *> action{nullptr};
+    return action;
+}
+inline std::atomic<qint64> &documentSize() {
+    static std::atomic<qint64> size{0};
+    return size;
+}
+inline void setDocumentSize(qint64 chars) { documentSize().store(chars, std::memory_order_relaxed); }
+
+// Labels what the user is doing for the duration of a scope. A scope with
+// replace=false only labels otherwise idle time, so the handler's generic
+// "edit" does not hide an enclosing "paste".
+class ActionScope {
+    const char *prev;
+    bool set;
+public:
+    explicit ActionScope(const char *action, bool replace = true) {
+        prev = currentAction().load(std::memory_order_relaxed);
+        set = replace || !prev;
+        if (set) currentAction().store(action, std::memory_order_relaxed);
+    }
+    ~ActionScope() {
+        if (set) currentAction().store(prev, std::memory_order_relaxed);
+    }
+    ActionScope(const ActionScope &) = delete;
+    ActionScope &operator=(const ActionScope &) = delete;
+};
+
+#if defined(Q_OS_LINUX)
+namespace detail {
+constexpr int maxFrames = 64;
+inline void *frames[maxFrames];
+inline std::atomic<int> frameCount{0};
+inline std::atomic<bool> sampleReady{false};
+
+inline void onStackSample(int) {
+    frameCount.store(backtrace(frames, maxFrames), std::memory_order_relaxed);
+    sampleReady.store(true, std::memory_order_release);
+}
+
+inline QString demangleFrame(const char *sym) {
+    // "binary(mangled+0x1f) [0xaddr]"
+    QByteArray s(sym);
+    const int open = int(s.indexOf('(')), plus = int(s.indexOf('+', open));
+    if (open < 0 || plus < 0) return QString::fromLocal8Bit(s);
+    const QByteArray mangled = s.mid(open + 1, plus - open - 1);
+    int status = 0;
+    char *name = abi::__cxa_demangle(mangled.constData(), nullptr, nullptr, &status);
+    if (status != 0 || !name) return QString::fromLocal8Bit(s);
+    QString out = QString::fromLocal8Bit(name) + "  " + QString::fromLocal8Bit(s.mid(plus));
+    std::free(name);
+    return out;
+}
+} // namespace detail
+#endif
+
+class StallWatchdog {
+public:
+    // Must be constructed on the GUI thread; `gui` receives the pings.
+    StallWatchdog(QObject *gui, int thresholdMs, const QString &logPath = QString())
+        : guiObject(gui), threshold(thresholdMs), guiSpans(&tracing::threadBuffer()) {
+        if (!logPath.isEmpty()) {
+            log.setFileName(logPath);
+            if (!log.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text))
+                qWarning("watchdog: cannot open %s", qPrintable(logPath));
+        }
+#if defined(Q_OS_LINUX)
+        guiThread = pthread_self();
+        void *warm[1];
+        backtrace(warm, 1); // loads libgcc now, not inside the signal handler
+        struct sigaction sa = {};
+        sa.sa_handler = detail::onStackSample;
+        sa.sa_flags = SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGUSR2, &sa, nullptr);
+#endif
+    }
+
+    ~StallWatchdog() { stop(); }
+
+    void start() {
+        if (threshold <= 0 || worker.joinable()) return;
+        tracing::setActiveStackTracking(true);
+        running = true;
+        worker = std::thread([this]() { run(); });
+    }
+
+    void stop() {
+        if (!worker.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            running = false;
+        }
+        cv.notify_all();
+        worker.join();
+    }
+
+private:
+    QObject *guiObject;
+    const int threshold;
+    tracing::ThreadBuffer *guiSpans;
+    QFile log;
+    std::thread worker;
+    std::mutex mu;
+    std::condition_variable cv;
+    bool running = false;
+    // Shared with queued pings, which may outlive the watchdog at shutdown.
+    std::shared_ptr<std::atomic<quint64>> acked = std::make_shared<std::atomic<quint64>>(0);
+#if defined(Q_OS_LINUX)
+    pthread_t guiThread;
+#endif
+
+    // Sleeps up to ms; false once stop() was requested.
+    bool wait(int ms) {
+        std::unique_lock<std::mutex> lock(mu);
+        return !cv.wait_for(lock, std::chrono::milliseconds(ms), [this]() { return !running; });
+    }
+
+    void run() {
+        using clock = std::chrono::steady_clock;
+        const int poll = qBound(1, threshold / 5, 10);
+        quint64 seq = 0;
+        while (true) {
+            const quint64 sent = ++seq;
+            const auto sentAt = clock::now();
+            QMetaObject::invokeMethod(guiObject, [ack = acked, sent]() { ack->store(sent, std::memory_order_relaxed); },
+                                      Qt::QueuedConnection);
+            bool reported = false;
+            while (acked->load(std::memory_order_relaxed) < sent) {
+                if (!wait(poll)) return;
+                const qint64 ms = std::chrono::duration_cast<std::chrono::milliseconds>(clock::now() - sentAt).count();
+                if (!reported && ms >= threshold) {
+                    report(ms);
+                    reported = true;
+                }
+            }
+            if (reported) {
+                const qint64 total = std::chrono::duration_cast<std::chrono::milliseconds>(clock::now() - sentAt).count();
+                write(QString("UI stall ended after %1 ms").arg(total));
+            }
+            if (!wait(qMax(poll, threshold / 2))) return;
+        }
+    }
+
+    void report(qint64 ms) {
+        const char *action = currentAction().load(std::memory_order_relaxed);
+        QStringList spans;
+        for (const char *s : guiSpans->activeStack()) spans << QString::fromLatin1(s ? s : "?");
+        write(QString("UI stall: %1 ms (threshold %2 ms) action=%3 document=%4 chars spans=[%5]")
+                  .arg(ms)
+                  .arg(threshold)
+                  .arg(QString::fromLatin1(action ? action : "idle"))
+                  .arg(documentSize().load(std::memory_order_relaxed))
+                  .arg(spans.join(" > ")));
+        for (const QString &frame : sampleGuiStack()) write("    " + frame);
+    }
+
+    QStringList sampleGuiStack() {
+        QStringList out;
+#if defined(Q_OS_LINUX)
+        detail::sampleReady.store(false, std::memory_order_relaxed);
+        if (pthread_kill(guiThread, SIGUSR2) != 0) return out;
+        for (int i = 0; i < 50 && !detail::sampleReady.load(std::memory_order_acquire); ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        if (!detail::sampleReady.load(std::memory_order_acquire)) return out;
+        const int n = detail::frameCount.load(std::memory_order_relaxed);
+        char **syms = backtrace_symbols(detail::frames, n);
+        if (!syms) return out;
+        for (int i = 2; i < n; ++i) out << detail::demangleFrame(syms[i]); // skip handler + trampoline
+        std::free(syms);
+#endif
+        return out;
+    }
+
+    void write(const QString &line) {
+        qWarning("%s", qPrintable(line));
+        if (log.isOpen()) {
+            log.write((QDateTime::currentDateTime().toString(Qt::ISODateWithMs) + ' ' + line + '\n').toUtf8());
+            log.flush();
+        }
+    }
+};
+
+} // namespace watchdog